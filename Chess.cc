@@ -20,54 +20,9 @@
 
 #include "Chess.hh"
 
-
-
-namespace Thief {
-
-LGMulti<Chess::Piece>::LGMulti (const Chess::Piece& value)
-	: LGMulti<int> (value.get_code ())
-{}
-
-LGMulti<Chess::Piece>::operator Chess::Piece () const
-{
-	return Chess::Piece (char (operator int ()));
-}
-
-LGMulti<Chess::Side>::LGMulti (const Chess::Side& value)
-	: LGMulti<int> (value.value)
-{}
-
-LGMulti<Chess::Side>::operator Chess::Side () const
-{
-	return Chess::Side (Chess::Side::Value (operator int ()));
-}
-
-THIEF_ENUM_CODING (Chess::Side::Value, CODE, CODE,
-	THIEF_ENUM_VALUE (NONE, "-", "none"),
-	THIEF_ENUM_VALUE (WHITE, "w", "white"),
-	THIEF_ENUM_VALUE (BLACK, "b", "black"),
-)
-
-template<>
-bool
-Parameter<Chess::Side>::decode (const String& raw) const
-{
-	if (raw.empty ())
-		return false;
-
-	value.value = Chess::Side::Value
-		(EnumCoding::get<Chess::Side::Value> ().decode (raw));
-	return true;
-}
-
-template<>
-String
-Parameter<Chess::Side>::encode () const
-{
-	return EnumCoding::get<Chess::Side::Value> ().encode (value.value);
-}
-
-} // namespace Thief
+#if defined (__i386__) || defined (__x86_64__)
+#include <cpuid.h>
+#endif
 
 
 
@@ -282,29 +237,521 @@ Piece::get_codes (Side side)
 
 
 
+// Attacks
+
+// The fixed tables are computed at compile time by these constexpr
+// functions, which work on (file, rank) pairs so that steps off the board
+// can simply be dropped.
+
+static constexpr bool
+is_on_board (int file, int rank)
+{
+	return file >= 0 && file < 8 && rank >= 0 && rank < 8;
+}
+
+static constexpr Bitboard
+square_bit (int file, int rank)
+{
+	return is_on_board (file, rank)
+		? Bitboard (1u) << (rank * 8 + file) : Bitboard (0u);
+}
+
+static constexpr int
+sign (int value)
+{
+	return (value > 0) - (value < 0);
+}
+
+static constexpr int KING_STEPS [8u] [2u] =
+	{ {1,1}, {1,0}, {1,-1}, {0,-1}, {-1,-1}, {-1,0}, {-1,1}, {0,1} };
+
+static constexpr int KNIGHT_STEPS [8u] [2u] =
+	{ {1,2}, {2,1}, {-1,2}, {-2,1}, {-1,-2}, {-2,-1}, {1,-2}, {2,-1} };
+
+static constexpr Bitboard
+leap (int file, int rank, const int (&steps) [8u] [2u], size_t step = 0u)
+{
+	return (step == 8u) ? Bitboard (0u)
+		: square_bit (file + steps [step] [0u], rank + steps [step] [1u])
+			| leap (file, rank, steps, step + 1u);
+}
+
+// Every square from (file, rank) in a direction, to the edge of the board
+static constexpr Bitboard
+ray (int file, int rank, int delta_file, int delta_rank)
+{
+	return is_on_board (file + delta_file, rank + delta_rank)
+		? square_bit (file + delta_file, rank + delta_rank) |
+			ray (file + delta_file, rank + delta_rank,
+				delta_file, delta_rank)
+		: Bitboard (0u);
+}
+
+// The next count - 1 squares from (file, rank) in a direction
+static constexpr Bitboard
+segment (int file, int rank, int delta_file, int delta_rank, int count)
+{
+	return (count <= 1) ? Bitboard (0u)
+		: square_bit (file + delta_file, rank + delta_rank) |
+			segment (file + delta_file, rank + delta_rank,
+				delta_file, delta_rank, count - 1);
+}
+
+static constexpr bool
+is_aligned (int delta_file, int delta_rank)
+{
+	return (delta_file != 0 || delta_rank != 0) &&
+		(delta_file == 0 || delta_rank == 0 ||
+			delta_file == delta_rank || delta_file == -delta_rank);
+}
+
+static constexpr Bitboard
+between (int file, int rank, int delta_file, int delta_rank)
+{
+	return is_aligned (delta_file, delta_rank)
+		? segment (file, rank, sign (delta_file), sign (delta_rank),
+			(delta_file != 0) ? sign (delta_file) * delta_file
+				: sign (delta_rank) * delta_rank)
+		: Bitboard (0u);
+}
+
+static constexpr Bitboard
+line (int file, int rank, int delta_file, int delta_rank)
+{
+	return is_aligned (delta_file, delta_rank)
+		? ray (file, rank, sign (delta_file), sign (delta_rank)) |
+			ray (file, rank, -sign (delta_file), -sign (delta_rank)) |
+			square_bit (file, rank)
+		: Bitboard (0u);
+}
+
+// The sliding directions. The first four lead to higher square indices.
+static constexpr int DIRECTIONS [8u] [2u] =
+	{ {0,1}, {1,0}, {1,1}, {-1,1}, {0,-1}, {-1,0}, {-1,-1}, {1,-1} };
+static constexpr unsigned ROOK_DIRECTIONS [4u] = { 0u, 1u, 4u, 5u };
+static constexpr unsigned BISHOP_DIRECTIONS [4u] = { 2u, 3u, 6u, 7u };
+
+// Each generator gives a table entry from its index. Two-square tables are
+// indexed by from * Square::COUNT + to; PAWN and RAYS by a leading side or
+// direction in the same way.
+
+struct KingGenerator
+{
+	static constexpr Bitboard get (size_t index)
+		{ return leap (index % 8u, index / 8u, KING_STEPS); }
+};
+
+struct KnightGenerator
+{
+	static constexpr Bitboard get (size_t index)
+		{ return leap (index % 8u, index / 8u, KNIGHT_STEPS); }
+};
+
+struct PawnGenerator
+{
+	static constexpr Bitboard get (size_t index)
+	{
+		return square_bit (int (index % 8u) - 1,
+				int (index % 64u / 8u) + (index < 64u ? 1 : -1)) |
+			square_bit (int (index % 8u) + 1,
+				int (index % 64u / 8u) + (index < 64u ? 1 : -1));
+	}
+};
+
+struct BetweenGenerator
+{
+	static constexpr Bitboard get (size_t index)
+	{
+		return between (index / 64u % 8u, index / 512u,
+			int (index % 8u) - int (index / 64u % 8u),
+			int (index % 64u / 8u) - int (index / 512u));
+	}
+};
+
+struct LineGenerator
+{
+	static constexpr Bitboard get (size_t index)
+	{
+		return line (index / 64u % 8u, index / 512u,
+			int (index % 8u) - int (index / 64u % 8u),
+			int (index % 64u / 8u) - int (index / 512u));
+	}
+};
+
+struct RayGenerator
+{
+	static constexpr Bitboard get (size_t index)
+	{
+		return ray (index % 8u, index % 64u / 8u,
+			DIRECTIONS [index / 64u] [0u],
+			DIRECTIONS [index / 64u] [1u]);
+	}
+};
+
+// A list of the indices of a table, built by halves to keep the template
+// recursion shallow for the 4096-entry tables
+template <size_t... I> struct IndexList {};
+
+template <typename, typename> struct JoinIndexLists;
+template <size_t... A, size_t... B>
+struct JoinIndexLists<IndexList<A...>, IndexList<B...>>
+	{ typedef IndexList<A..., (sizeof... (A) + B)...> Type; };
+
+template <size_t N> struct MakeIndexList
+{
+	typedef typename JoinIndexLists<typename MakeIndexList<N / 2u>::Type,
+		typename MakeIndexList<N - N / 2u>::Type>::Type Type;
+};
+template <> struct MakeIndexList<0u> { typedef IndexList<> Type; };
+template <> struct MakeIndexList<1u> { typedef IndexList<0u> Type; };
+
+template <typename Generator, size_t... I>
+static constexpr BitboardTable<sizeof... (I)>
+make_table (IndexList<I...>)
+{
+	return {{ Generator::get (I)... }};
+}
+
+template <typename Generator, size_t N>
+static constexpr BitboardTable<N>
+make_table ()
+{
+	return make_table<Generator> (typename MakeIndexList<N>::Type ());
+}
+
+const BitboardTable<Square::COUNT>
+Attacks::KING = make_table<KingGenerator, Square::COUNT> ();
+
+const BitboardTable<Square::COUNT>
+Attacks::KNIGHT = make_table<KnightGenerator, Square::COUNT> ();
+
+const BitboardTable<2u * Square::COUNT>
+Attacks::PAWN = make_table<PawnGenerator, 2u * Square::COUNT> ();
+
+const BitboardTable<Square::COUNT * Square::COUNT>
+Attacks::BETWEEN = make_table<BetweenGenerator,
+	Square::COUNT * Square::COUNT> ();
+
+const BitboardTable<Square::COUNT * Square::COUNT>
+Attacks::LINE = make_table<LineGenerator, Square::COUNT * Square::COUNT> ();
+
+static const BitboardTable<8u * Square::COUNT>
+RAYS = make_table<RayGenerator, 8u * Square::COUNT> ();
+
+static_assert (KnightGenerator::get (0u) == 0x20400u &&
+	PawnGenerator::get (64u + 12u) == 0x28u &&
+	BetweenGenerator::get (0u * 64u + 63u) == 0x0040201008040200u &&
+	LineGenerator::get (1u * 64u + 2u) == 0xFFu &&
+	BetweenGenerator::get (0u * 64u + 10u) == 0u,
+	"attack tables are miscomputed");
+
+Attacks::Slider Attacks::ROOK [Square::COUNT];
+Attacks::Slider Attacks::BISHOP [Square::COUNT];
+bool Attacks::USE_PEXT = false;
+
+// Each table holds, for every square, one entry per subset of the square's
+// relevant occupancy mask (4096 for a rook in a corner, 5 to 12 bits each).
+static Bitboard ROOK_ATTACKS [0x19000u];
+static Bitboard BISHOP_ATTACKS [0x1480u];
+
+// The squares attacked in the given directions, up to and including the
+// nearest occupied square in each
+static Bitboard
+slide (Square::Index from, Bitboard occupied,
+	const unsigned (&directions) [4u])
+{
+	Bitboard result = 0u;
+	for (unsigned direction : directions)
+	{
+		Bitboard attacks = RAYS [direction * Square::COUNT + from],
+			blockers = attacks & occupied;
+		if (blockers)
+			attacks &= ~RAYS [direction * Square::COUNT +
+				((direction < 4u) ? get_first_index (blockers)
+					: get_last_index (blockers))];
+		result |= attacks;
+	}
+	return result;
+}
+
+static bool
+has_fast_pext ()
+{
+#if (defined (__i386__) || defined (__x86_64__)) && !defined (CHESS_NO_PEXT)
+	unsigned eax, ebx, ecx, edx;
+	if (__get_cpuid_max (0u, nullptr) < 7u) return false;
+
+	__cpuid (0u, eax, ebx, ecx, edx);
+	bool amd = (ebx == 0x68747541u); // "AuthenticAMD"
+	__cpuid (1u, eax, ebx, ecx, edx);
+	unsigned family = ((eax >> 8) & 0xFu) + ((eax >> 20) & 0xFFu);
+
+	__cpuid_count (7u, 0u, eax, ebx, ecx, edx);
+	if (!(ebx & bit_BMI2)) return false;
+
+	// Before Zen 3, AMD implemented PEXT in slow microcode.
+	return !amd || family >= 0x19u;
+#else
+	return false;
+#endif
+}
+
+// xorshift64* generator for the magic search. The seeds (one per rank) are
+// known to find a full set of magics quickly, so startup stays brief.
+class MagicRandom
+{
+public:
+	explicit MagicRandom (uint64_t _state) : state (_state) {}
+
+	uint64_t next ()
+	{
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 2685821657736338717u;
+	}
+
+	uint64_t next_sparse () { return next () & next () & next (); }
+
+private:
+	uint64_t state;
+};
+
+static const uint64_t
+MAGIC_SEEDS[] = { 728, 10316, 55013, 32803, 12281, 15100, 16645, 255 };
+
+struct AttacksInitializer
+{
+	AttacksInitializer ();
+
+	static void initialize_sliders (Attacks::Slider (&sliders)
+		[Square::COUNT], Bitboard* table,
+		const unsigned (&directions) [4u]);
+};
+
+AttacksInitializer::AttacksInitializer ()
+{
+	Attacks::USE_PEXT = has_fast_pext ();
+	initialize_sliders (Attacks::ROOK, ROOK_ATTACKS, ROOK_DIRECTIONS);
+	initialize_sliders (Attacks::BISHOP, BISHOP_ATTACKS, BISHOP_DIRECTIONS);
+}
+
+void
+AttacksInitializer::initialize_sliders (Attacks::Slider (&sliders)
+	[Square::COUNT], Bitboard* table, const unsigned (&directions) [4u])
+{
+	static Bitboard occupancies [4096u], references [4096u];
+	static unsigned attempts [4096u];
+	unsigned attempt = 0u;
+
+	for (auto from = Square::BEGIN; from.is_valid (); ++from)
+	{
+		Square::Index index = from.get_index ();
+		Attacks::Slider& slider = sliders [index];
+
+		// Board edges only matter when the slider is on them.
+		Bitboard edges =
+			((get_bitboard (Rank::R1) | get_bitboard (Rank::R8))
+				& ~get_bitboard (from.rank)) |
+			((get_bitboard (File::A) | get_bitboard (File::H))
+				& ~get_bitboard (from.file));
+
+		slider.mask = slide (index, 0u, directions) & ~edges;
+		slider.shift = 64u - count_squares (slider.mask);
+		slider.attacks = (index == 0u) ? table
+			: sliders [index - 1u].attacks +
+				(size_t (1u) << (64u - sliders [index - 1u].shift));
+
+		// Enumerate every subset of the mask with its attack set.
+		size_t count = 0u;
+		Bitboard subset = 0u;
+		do
+		{
+			occupancies [count] = subset;
+			references [count++] = slide (index, subset, directions);
+			subset = (subset - slider.mask) & slider.mask;
+		}
+		while (subset);
+
+		if (Attacks::USE_PEXT)
+		{
+			slider.magic = 0u;
+			for (size_t i = 0u; i < count; ++i)
+				slider.attacks [slider.get_index (occupancies [i])]
+					= references [i];
+			continue;
+		}
+
+		// Find a magic that maps the subsets without any destructive
+		// collisions. Entries are marked by attempt rather than cleared.
+		MagicRandom random (MAGIC_SEEDS [size_t (from.rank)]);
+		for (size_t i = 0u; i < count;)
+		{
+			do slider.magic = random.next_sparse ();
+			while (count_squares ((slider.magic * slider.mask) >> 56)
+				< 6u);
+
+			for (++attempt, i = 0u; i < count; ++i)
+			{
+				size_t entry = slider.get_index (occupancies [i]);
+				if (attempts [entry] < attempt)
+				{
+					attempts [entry] = attempt;
+					slider.attacks [entry] = references [i];
+				}
+				else if (slider.attacks [entry] != references [i])
+					break;
+			}
+		}
+	}
+}
+
+static AttacksInitializer attacks_initializer;
+
+
+
+// CompactMove
+
+String
+CompactMove::get_uci_code () const
+{
+	String result = get_from ().get_code () + get_to ().get_code ();
+	if (is_promotion ())
+		result += Piece (Side::BLACK, get_promotion ()).get_code ();
+	return result;
+}
+
+
+
 // Event
 
 Event::~Event () {}
 
-Event::Ptr
-Event::deserialize (const MLAN& mlan, Side active_side)
+MLAN
+Event::serialize () const
 {
-	Event::Ptr result;
+	char mlan [MAX_MLAN_LENGTH + 1u];
+	return MLAN (mlan, serialize_to (mlan, sizeof mlan));
+}
 
-#define TRY_PARSE(type) \
-	{ result = type::deserialize (mlan, active_side); \
-	if (result && result->is_valid ()) return result; }
+static bool
+token_is (const char* begin, const char* end, const char* literal)
+{
+	for (; begin != end; ++begin, ++literal)
+		if (*literal == '\0' || *begin != *literal)
+			return false;
+	return *literal == '\0';
+}
 
-	TRY_PARSE (Loss);
-	TRY_PARSE (Draw);
-		TRY_PARSE (Castling);
-		TRY_PARSE (TwoSquarePawnMove);
-			TRY_PARSE (EnPassantCapture);
-		TRY_PARSE (Capture);
-	TRY_PARSE (Move);
+static Square
+parse_square (const char* code)
+{
+	return Square (File (tolower (code [0u]) - 'a'),
+		Rank (code [1u] - '1'));
+}
 
-	result.reset ();
-	return result;
+// Decides the kind of event from the shape of the token in a single pass.
+static Event::Ptr
+parse_mlan (const char* begin, const char* end, Side active_side)
+{
+	// Losses, draws and castling are fixed tokens.
+
+	if (token_is (begin, end, "#"))
+		return std::make_shared<Loss> (Loss::Type::CHECKMATE, active_side);
+	if (token_is (begin, end, "0"))
+		return std::make_shared<Loss>
+			(Loss::Type::RESIGNATION, active_side);
+	if (end - begin == 3 && begin [0u] == 'T' && begin [1u] == 'C')
+		return std::make_shared<Loss>
+			(Loss::Type::TIME_CONTROL, Side (begin [2u]));
+
+	if (token_is (begin, end, "SM"))
+		return std::make_shared<Draw> (Draw::Type::STALEMATE);
+	if (token_is (begin, end, "DP"))
+		return std::make_shared<Draw> (Draw::Type::DEAD_POSITION);
+	if (token_is (begin, end, "50M"))
+		return std::make_shared<Draw> (Draw::Type::FIFTY_MOVE);
+	if (token_is (begin, end, "3FR"))
+		return std::make_shared<Draw> (Draw::Type::THREEFOLD_REPETITION);
+	if (token_is (begin, end, "="))
+		return std::make_shared<Draw> (Draw::Type::BY_AGREEMENT);
+
+	if (token_is (begin, end, "0-0"))
+		return std::make_shared<Castling>
+			(active_side, Castling::Type::KINGSIDE);
+	if (token_is (begin, end, "0-0-0"))
+		return std::make_shared<Castling>
+			(active_side, Castling::Type::QUEENSIDE);
+
+	// Other moves have the form Pa1-b2 or Pa1xpb2, then an optional
+	// promoted piece and an optional e.p. or t.s. suffix.
+
+	if (end - begin < 6 || (begin [3u] != '-' && begin [3u] != 'x'))
+		return nullptr;
+
+	Piece piece (begin [0u]), captured;
+	Square from = parse_square (begin + 1u);
+	const char* pos = begin + 4u;
+	bool is_capture = begin [3u] == 'x';
+	if (is_capture)
+		captured = Piece (*pos++);
+	if (end - pos < 2) return nullptr;
+	Square to = parse_square (pos);
+	pos += 2u;
+
+	bool en_passant = false, two_square = false;
+	if (end - pos >= 4)
+	{
+		en_passant = token_is (end - 4u, end, "e.p.");
+		two_square = token_is (end - 4u, end, "t.s.");
+		if (en_passant || two_square) end -= 4u;
+	}
+	if (end - pos > 1) return nullptr;
+	char promotion = (pos != end) ? *pos : '\0';
+
+	std::shared_ptr<Move> move;
+	if (en_passant && is_capture)
+		move = std::make_shared<EnPassantCapture>
+			(piece.side, from.file, to.file);
+	else if (two_square && !is_capture)
+		move = std::make_shared<TwoSquarePawnMove>
+			(piece.side, from.file);
+	else if (en_passant || two_square)
+		return nullptr;
+	else if (is_capture)
+		move = std::make_shared<Capture> (piece, from, to, captured);
+	else
+		move = std::make_shared<Move> (piece, from, to);
+
+	// The special moves are built from the side and files alone, so the
+	// rest of the token must agree with them.
+	if (!move->is_valid () || move->get_side () != active_side ||
+	    move->get_piece () != piece || move->get_from () != from ||
+	    move->get_to () != to)
+		return nullptr;
+	if (is_capture && static_cast<const Capture&> (*move)
+			.get_captured_piece () != captured)
+		return nullptr;
+
+	if (promotion ? (move->get_promoted_piece ().get_code () != promotion)
+		: move->get_promoted_piece ().is_valid ())
+		return nullptr;
+
+	return move;
+}
+
+Event::Ptr
+Event::deserialize (const MLAN& mlan, Side active_side)
+{
+	return deserialize (mlan.data (), mlan.data () + mlan.length (),
+		active_side);
+}
+
+Event::Ptr
+Event::deserialize (const char* begin, const char* end, Side active_side)
+{
+	Event::Ptr result = parse_mlan (begin, end, active_side);
+	return (result && result->is_valid ()) ? result : nullptr;
 }
 
 bool
@@ -340,35 +787,18 @@ Loss::Loss (Type _type, Side _side)
 	}
 }
 
-Event::Ptr
-Loss::deserialize (const MLAN& mlan, Side active_side)
-{
-	Type type = Type::NONE;
-	Side side = active_side;
-	if (mlan == "#")
-		type = Type::CHECKMATE;
-	else if (mlan == "0")
-		type = Type::RESIGNATION;
-	else if (mlan.length () == 3u && mlan.substr (0u, 2u) == "TC")
-	{
-		type = Type::TIME_CONTROL;
-		side = Side (mlan [2u]);
-	}
-	else
-		return nullptr;
-	return std::make_shared<Loss> (type, side);
-}
-
-MLAN
-Loss::serialize () const
+size_t
+Loss::serialize_to (char* buffer, size_t size) const
 {
+	BufferWriter mlan (buffer, size);
 	switch (type)
 	{
-	case Type::CHECKMATE: return "#";
-	case Type::RESIGNATION: return "0";
-	case Type::TIME_CONTROL: return String ("TC") + side.get_code ();
-	default: return String ();
+	case Type::CHECKMATE: mlan << "#"; break;
+	case Type::RESIGNATION: mlan << "0"; break;
+	case Type::TIME_CONTROL: mlan << "TC" << side.get_code (); break;
+	default: break;
 	}
+	return mlan.get_length ();
 }
 
 Side
@@ -431,37 +861,20 @@ Draw::Draw (Type _type)
 	}
 }
 
-Event::Ptr
-Draw::deserialize (const MLAN& mlan, Side)
-{
-	Type type = Type::NONE;
-	if (mlan == "SM")
-		type = Type::STALEMATE;
-	else if (mlan == "DP")
-		type = Type::DEAD_POSITION;
-	else if (mlan == "50M")
-		type = Type::FIFTY_MOVE;
-	else if (mlan == "3FR")
-		type = Type::THREEFOLD_REPETITION;
-	else if (mlan == "=")
-		type = Type::BY_AGREEMENT;
-	else
-		return nullptr;
-	return std::make_shared<Draw> (type);
-}
-
-MLAN
-Draw::serialize () const
+size_t
+Draw::serialize_to (char* buffer, size_t size) const
 {
+	BufferWriter mlan (buffer, size);
 	switch (type)
 	{
-	case Type::STALEMATE: return "SM";
-	case Type::DEAD_POSITION: return "DP";
-	case Type::FIFTY_MOVE: return "50M";
-	case Type::THREEFOLD_REPETITION: return "3FR";
-	case Type::BY_AGREEMENT: return "=";
-	default: return String ();
+	case Type::STALEMATE: mlan << "SM"; break;
+	case Type::DEAD_POSITION: mlan << "DP"; break;
+	case Type::FIFTY_MOVE: mlan << "50M"; break;
+	case Type::THREEFOLD_REPETITION: mlan << "3FR"; break;
+	case Type::BY_AGREEMENT: mlan << "="; break;
+	default: break;
 	}
+	return mlan.get_length ();
 }
 
 Side
@@ -522,34 +935,15 @@ Move::Move (const Piece& _piece, const Square& _from, const Square& _to)
 		promotion = Piece::Type::QUEEN; // Always promote to queen.
 }
 
-Event::Ptr
-Move::deserialize (const MLAN& mlan, Side active_side)
+size_t
+Move::serialize_to (char* buffer, size_t size) const
 {
-	if (mlan.length () < 6u || mlan.length () > 7u || mlan [3u] != '-')
-		return nullptr;
-
-	auto move = std::make_shared<Move> (Piece (mlan [0u]),
-		Square (mlan.substr (1u, 2u)), Square (mlan.substr (4u, 2u)));
-	if (!move || !move->is_valid () || move->get_side () != active_side)
-		return nullptr;
-
-	if ((mlan.length () == 7u &&
-		move->get_promoted_piece ().get_code () != mlan [6u]) ||
-	    (mlan.length () == 6u && move->get_promoted_piece ().is_valid ()))
-		return nullptr;
-
-	return move;
-}
-
-MLAN
-Move::serialize () const
-{
-	String result;
-	if (!is_valid ()) return result;
-	result = piece.get_code () + from.get_code () + '-' + to.get_code ();
+	BufferWriter mlan (buffer, size);
+	if (!is_valid ()) return 0u;
+	mlan << piece.get_code () << from << '-' << to;
 	if (get_promoted_piece ().is_valid ())
-		result += get_promoted_piece ().get_code ();
-	return result;
+		mlan << get_promoted_piece ().get_code ();
+	return mlan.get_length ();
 }
 
 Side
@@ -558,6 +952,13 @@ Move::get_side () const
 	return piece.side;
 }
 
+CompactMove
+Move::get_compact () const
+{
+	return is_valid () ? CompactMove (from, to,
+		CompactMove::get_promotion_flags (promotion)) : CompactMove ();
+}
+
 String
 Move::get_uci_code () const
 {
@@ -606,37 +1007,16 @@ Capture::Capture (const Piece& _piece, const Square& _from,
 		
 }
 
-Event::Ptr
-Capture::deserialize (const MLAN& mlan, Side active_side)
-{
-	if (mlan.length () < 7u || mlan.length () > 8u || mlan [3u] != 'x')
-		return nullptr;
-
-	auto capture = std::make_shared<Capture> (Piece (mlan [0u]),
-		Square (mlan.substr (1u, 2u)), Square (mlan.substr (5u, 2u)),
-		Piece (mlan [4u]));
-	if (!capture || !capture->is_valid () ||
-	    capture->get_side () != active_side)
-		return nullptr;
-
-	if ((mlan.length () == 8u &&
-		capture->get_promoted_piece ().get_code () != mlan [7u]) ||
-	    (mlan.length () == 7u && capture->get_promoted_piece ().is_valid ()))
-		return nullptr;
-
-	return capture;
-}
-
-MLAN
-Capture::serialize () const
+size_t
+Capture::serialize_to (char* buffer, size_t size) const
 {
-	String result;
-	if (!is_valid ()) return result;
-	result = get_piece ().get_code () + get_from ().get_code () + 'x' +
-		captured_piece.get_code () + get_to ().get_code ();
+	BufferWriter mlan (buffer, size);
+	if (!is_valid ()) return 0u;
+	mlan << get_piece ().get_code () << get_from () << 'x'
+		<< captured_piece.get_code () << get_to ();
 	if (get_promoted_piece ().is_valid ())
-		result += get_promoted_piece ().get_code ();
-	return result;
+		mlan << get_promoted_piece ().get_code ();
+	return mlan.get_length ();
 }
 
 Square
@@ -645,6 +1025,15 @@ Capture::get_captured_square () const
 	return get_to ();
 }
 
+CompactMove
+Capture::get_compact () const
+{
+	return is_valid () ? CompactMove (get_from (), get_to (),
+		CompactMove::CAPTURE |
+		CompactMove::get_promotion_flags (get_promotion ()))
+		: CompactMove ();
+}
+
 String
 Capture::describe () const
 {
@@ -683,26 +1072,14 @@ EnPassantCapture::EnPassantCapture (Side side, File _from, File _to)
 		invalidate ();
 }
 
-Event::Ptr
-EnPassantCapture::deserialize (const MLAN& mlan, Side active_side)
-{
-	size_t pos = mlan.length ();
-	if (pos < 4u || mlan.substr (pos - 4u) != "e.p.")
-		return nullptr;
-
-	auto capture = std::dynamic_pointer_cast<Capture>
-		(Capture::deserialize (mlan.substr (0u, pos - 4u), active_side));
-	if (!capture || !capture->is_valid ())
-		return nullptr;
-
-	return std::make_shared<EnPassantCapture> (capture->get_side (),
-		capture->get_from ().file, capture->get_to ().file);
-}
-
-MLAN
-EnPassantCapture::serialize () const
+size_t
+EnPassantCapture::serialize_to (char* buffer, size_t size) const
 {
-	return is_valid () ? (Capture::serialize () + "e.p.") : String ();
+	size_t length = Capture::serialize_to (buffer, size);
+	if (!is_valid ()) return length;
+	BufferWriter suffix (buffer + length, size - length);
+	suffix << "e.p.";
+	return length + suffix.get_length ();
 }
 
 Square
@@ -711,6 +1088,13 @@ EnPassantCapture::get_captured_square () const
 	return captured_square;
 }
 
+CompactMove
+EnPassantCapture::get_compact () const
+{
+	return is_valid () ? CompactMove (get_from (), get_to (),
+		CompactMove::EN_PASSANT) : CompactMove ();
+}
+
 String
 EnPassantCapture::describe () const
 {
@@ -740,26 +1124,21 @@ TwoSquarePawnMove::TwoSquarePawnMove (Side side, File file)
 	  passed_square (file, (side == Side::WHITE) ? Rank::R3 : Rank::R6)
 {} // Move's validation will have failed on invalid side or file.
 
-Event::Ptr
-TwoSquarePawnMove::deserialize (const MLAN& mlan, Side active_side)
+size_t
+TwoSquarePawnMove::serialize_to (char* buffer, size_t size) const
 {
-	size_t pos = mlan.length ();
-	if (pos < 4u || mlan.substr (pos - 4u) != "t.s.")
-		return nullptr;
-
-	auto move = std::dynamic_pointer_cast<Move>
-		(Move::deserialize (mlan.substr (0u, pos - 4u), active_side));
-	if (!move || !move->is_valid ())
-		return nullptr;
-
-	return std::make_shared<TwoSquarePawnMove>
-		(move->get_side (), move->get_from ().file);
+	size_t length = Move::serialize_to (buffer, size);
+	if (!is_valid ()) return length;
+	BufferWriter suffix (buffer + length, size - length);
+	suffix << "t.s.";
+	return length + suffix.get_length ();
 }
 
-MLAN
-TwoSquarePawnMove::serialize () const
+CompactMove
+TwoSquarePawnMove::get_compact () const
 {
-	return is_valid () ? Move::serialize () + "t.s." : String ();
+	return is_valid () ? CompactMove (get_from (), get_to (),
+		CompactMove::TWO_SQUARE) : CompactMove ();
 }
 
 bool
@@ -791,28 +1170,25 @@ Castling::Castling (Side side, Type _type)
 	rook_to.file = (type == Type::KINGSIDE) ? File::F : File::D;
 }
 
-Event::Ptr
-Castling::deserialize (const MLAN& mlan, Side active_side)
-{
-	Type type = Type::NONE;
-	if (mlan == "0-0")
-		type = Type::KINGSIDE;
-	else if (mlan == "0-0-0")
-		type = Type::QUEENSIDE;
-	else
-		return nullptr;
-	return std::make_shared<Castling> (active_side, type);
-}
-
-MLAN
-Castling::serialize () const
+size_t
+Castling::serialize_to (char* buffer, size_t size) const
 {
+	BufferWriter mlan (buffer, size);
 	switch (type)
 	{
-	case Type::KINGSIDE: return "0-0";
-	case Type::QUEENSIDE: return "0-0-0";
-	default: return String ();
+	case Type::KINGSIDE: mlan << "0-0"; break;
+	case Type::QUEENSIDE: mlan << "0-0-0"; break;
+	default: break;
 	}
+	return mlan.get_length ();
+}
+
+CompactMove
+Castling::get_compact () const
+{
+	return is_valid () ? CompactMove (get_from (), get_to (),
+		(type == Type::KINGSIDE) ? CompactMove::KINGSIDE_CASTLING
+			: CompactMove::QUEENSIDE_CASTLING) : CompactMove ();
 }
 
 String
@@ -847,10 +1223,10 @@ StartGame::get_side () const
 	return Side::NONE;
 }
 
-MLAN
-StartGame::serialize () const
+size_t
+StartGame::serialize_to (char* buffer, size_t size) const
 {
-	return String ();
+	return BufferWriter (buffer, size).get_length ();
 }
 
 bool
@@ -888,10 +1264,10 @@ Check::get_side () const
 	return side;
 }
 
-MLAN
-Check::serialize () const
+size_t
+Check::serialize_to (char* buffer, size_t size) const
 {
-	return String ();
+	return BufferWriter (buffer, size).get_length ();
 }
 
 bool
@@ -915,5 +1291,48 @@ Check::get_concept () const
 
 
 
+// Hooks for the host application
+
+static String
+translate_default (const String& msgid, Side)
+{
+	return msgid;
+}
+
+static void
+log_default (const String& message)
+{
+	std::cerr << message << std::endl;
+}
+
+static Translator translator = translate_default;
+static Logger logger = log_default;
+
+void
+set_translator (Translator _translator)
+{
+	translator = _translator ? _translator : translate_default;
+}
+
+String
+translate (const String& msgid, Side side)
+{
+	return translator (msgid, side);
+}
+
+void
+set_logger (Logger _logger)
+{
+	logger = _logger ? _logger : log_default;
+}
+
+void
+log_message (const String& message)
+{
+	logger (message);
+}
+
+
+
 } // namespace Chess
 
@@ -21,7 +21,14 @@
 #ifndef CHESS_HH
 #define CHESS_HH
 
-#include <Thief/Thief.hh>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/format.hpp>
 
 namespace Chess {
 
@@ -45,6 +52,27 @@ enum class Case
 template <typename... Args>
 String translate_format (const String& msgid, Args... args);
 
+struct Square;
+
+// Writes text into a caller's fixed-size buffer without allocating, keeping
+// it terminated. Running out of room throws std::length_error.
+class BufferWriter
+{
+public:
+	BufferWriter (char* buffer, size_t size);
+
+	BufferWriter& operator << (char);
+	BufferWriter& operator << (const char*);
+	BufferWriter& operator << (unsigned);
+	BufferWriter& operator << (const Square&);
+
+	size_t get_length () const { return length; }
+
+private:
+	char* buffer;
+	size_t size, length;
+};
+
 
 
 // Square (File, Rank)
@@ -79,6 +107,11 @@ struct Square
 	static constexpr size_t COUNT = N_RANKS * N_FILES;
 	Square& operator ++ ();
 
+	// Bit position within a Bitboard: a1 = 0, b1 = 1, ..., h8 = 63.
+	typedef unsigned Index;
+	explicit Square (Index);
+	Index get_index () const;
+
 	void clear ();
 };
 
@@ -152,6 +185,150 @@ private:
 
 
 
+// Bitboard: set of squares, one bit per Square::Index
+
+typedef uint64_t Bitboard;
+
+Bitboard get_bitboard (Square::Index);
+Bitboard get_bitboard (const Square&);
+Bitboard get_bitboard (File);
+Bitboard get_bitboard (Rank);
+Bitboard get_bitboard (Square::Color);
+
+unsigned count_squares (Bitboard);
+Square::Index get_first_index (Bitboard); // must not be empty
+Square::Index get_last_index (Bitboard); // must not be empty
+Square::Index pop_first_index (Bitboard&); // must not be empty
+
+// Fixed table of bitboards that can be built in a constant expression
+template <size_t N>
+struct BitboardTable
+{
+	Bitboard values [N];
+	constexpr Bitboard operator [] (size_t index) const
+		{ return values [index]; }
+};
+
+// Squares attacked from a given square by each kind of piece. The sliding
+// pieces stop at (and include) the first occupied square in each direction.
+// Their attack sets are precomputed for every relevant occupancy and found
+// by magic multiplication or, on CPUs with a fast BMI2 PEXT, by extraction.
+struct Attacks
+{
+	static Bitboard king (Square::Index);
+	static Bitboard knight (Square::Index);
+	static Bitboard pawn (Side, Square::Index);
+	static Bitboard rook (Square::Index, Bitboard occupied);
+	static Bitboard bishop (Square::Index, Bitboard occupied);
+	static Bitboard queen (Square::Index, Bitboard occupied);
+
+	// Squares strictly between two squares on a rank, file or diagonal,
+	// and the whole line through them (both empty if they aren't aligned).
+	static Bitboard between (Square::Index, Square::Index);
+	static Bitboard line (Square::Index, Square::Index);
+
+private:
+	friend struct AttacksInitializer;
+
+	// These are computed at compile time.
+	static const BitboardTable<Square::COUNT> KING;
+	static const BitboardTable<Square::COUNT> KNIGHT;
+	static const BitboardTable<2u * Square::COUNT> PAWN; // by side, from
+	static const BitboardTable<Square::COUNT * Square::COUNT> BETWEEN;
+	static const BitboardTable<Square::COUNT * Square::COUNT> LINE;
+
+	struct Slider
+	{
+		Bitboard mask; // relevant occupancy: the rays, less their ends
+		Bitboard magic;
+		unsigned shift;
+		Bitboard* attacks;
+
+		size_t get_index (Bitboard occupied) const;
+	};
+	static Slider ROOK [Square::COUNT];
+	static Slider BISHOP [Square::COUNT];
+	static bool USE_PEXT;
+};
+
+
+
+// CompactMove: trivially copyable 16-bit form of a move, used for generation
+// and play. Full Move events are only created for moves recorded or shown.
+
+struct CompactMove
+{
+	// The bits under 4 hold the type of any promoted piece (as 4 - type)
+	// or identify the special moves; 0 is a simple move.
+	enum Flags : unsigned
+	{
+		TWO_SQUARE = 1u,
+		KINGSIDE_CASTLING = 2u,
+		QUEENSIDE_CASTLING = 3u,
+		CAPTURE = 4u,
+		EN_PASSANT = 5u,
+		PROMOTION = 8u
+	};
+
+	CompactMove () = default; // CompactMove () is zero (invalid)
+	CompactMove (Square::Index from, Square::Index to, unsigned flags = 0u);
+	CompactMove (const Square& from, const Square& to, unsigned flags = 0u);
+	uint16_t value; // from | to << 6 | flags << 12
+
+	bool is_valid () const;
+	bool operator == (const CompactMove&) const;
+	bool operator != (const CompactMove&) const;
+
+	Square::Index get_from_index () const;
+	Square::Index get_to_index () const;
+	Square get_from () const;
+	Square get_to () const;
+	unsigned get_flags () const;
+
+	bool is_capture () const;
+	bool is_en_passant () const;
+	bool is_two_square () const;
+	bool is_castling () const;
+	bool is_promotion () const;
+	Piece::Type get_promotion () const;
+
+	String get_uci_code () const;
+
+	static unsigned get_promotion_flags (Piece::Type);
+};
+
+// MoveList: fixed-capacity list of compact moves stored inline, so that
+// filling one never allocates. No legal position has more than 218 moves.
+
+class MoveList
+{
+public:
+	static constexpr size_t CAPACITY = 218u;
+
+	typedef const CompactMove* const_iterator;
+
+	MoveList ();
+	MoveList (const MoveList&);
+	MoveList& operator = (const MoveList&);
+
+	size_t size () const { return count; }
+	bool empty () const { return count == 0u; }
+	const CompactMove& operator [] (size_t index) const
+		{ return moves [index]; }
+
+	const_iterator begin () const { return moves; }
+	const_iterator end () const { return moves + count; }
+
+	void clear () { count = 0u; }
+	void push_back (CompactMove);
+
+private:
+	CompactMove moves [CAPACITY]; // only the first count are set
+	size_t count;
+};
+
+
+
 // Event
 
 class Event
@@ -166,8 +343,15 @@ public:
 
 	virtual Side get_side () const = 0;
 
-	virtual MLAN serialize () const = 0;
+	// Writes the MLAN into a buffer and returns its length. An event's
+	// MLAN never exceeds MAX_MLAN_LENGTH characters plus the terminator.
+	static constexpr size_t MAX_MLAN_LENGTH = 12u;
+	MLAN serialize () const;
+	virtual size_t serialize_to (char* buffer, size_t size) const = 0;
+
 	static Event::Ptr deserialize (const MLAN&, Side active_side);
+	static Event::Ptr deserialize (const char* begin, const char* end,
+		Side active_side);
 
 	virtual String describe () const = 0;
 	virtual String get_concept () const = 0;
@@ -210,8 +394,7 @@ public:
 
 	Loss (Type, Side);
 
-	static Event::Ptr deserialize (const MLAN&, Side active_side);
-	virtual MLAN serialize () const;
+	virtual size_t serialize_to (char* buffer, size_t size) const;
 
 	virtual Side get_side () const;
 	Type get_type () const { return type; }
@@ -252,8 +435,7 @@ public:
 
 	explicit Draw (Type);
 
-	static Event::Ptr deserialize (const MLAN&, Side active_side);
-	virtual MLAN serialize () const;
+	virtual size_t serialize_to (char* buffer, size_t size) const;
 
 	virtual Side get_side () const;
 	Type get_type () const { return type; }
@@ -279,8 +461,7 @@ public:
 
 	Move (const Piece&, const Square& from, const Square& to);
 
-	static Event::Ptr deserialize (const MLAN&, Side active_side);
-	virtual MLAN serialize () const;
+	virtual size_t serialize_to (char* buffer, size_t size) const;
 
 	virtual Side get_side () const;
 	Piece get_piece () const { return piece; }
@@ -289,6 +470,7 @@ public:
 	Piece::Type get_promotion () const { return promotion; }
 
 	Piece get_promoted_piece () const;
+	virtual CompactMove get_compact () const;
 
 	String get_uci_code () const;
 	virtual String describe () const;
@@ -316,11 +498,11 @@ public:
 	Capture (const Piece&, const Square& from,
 		const Square& to, const Piece& captured);
 
-	static Event::Ptr deserialize (const MLAN&, Side active_side);
-	virtual MLAN serialize () const;
+	virtual size_t serialize_to (char* buffer, size_t size) const;
 
 	const Piece& get_captured_piece () const { return captured_piece; }
 	virtual Square get_captured_square () const;
+	virtual CompactMove get_compact () const;
 
 	virtual String describe () const;
 
@@ -336,10 +518,10 @@ class EnPassantCapture : public Capture
 public:
 	EnPassantCapture (Side, File from, File to);
 
-	static Event::Ptr deserialize (const MLAN&, Side active_side);
-	virtual MLAN serialize () const;
+	virtual size_t serialize_to (char* buffer, size_t size) const;
 
 	virtual Square get_captured_square () const;
+	virtual CompactMove get_compact () const;
 
 	virtual String describe () const;
 
@@ -355,10 +537,10 @@ class TwoSquarePawnMove : public Move
 public:
 	TwoSquarePawnMove (Side, File);
 
-	static Event::Ptr deserialize (const MLAN&, Side active_side);
-	virtual MLAN serialize () const;
+	virtual size_t serialize_to (char* buffer, size_t size) const;
 
 	const Square& get_passed_square () const { return passed_square; }
+	virtual CompactMove get_compact () const;
 
 protected:
 	virtual bool equals (const Event&) const;
@@ -380,13 +562,13 @@ public:
 
 	Castling (Side, Type);
 
-	static Event::Ptr deserialize (const MLAN&, Side active_side);
-	virtual MLAN serialize () const;
+	virtual size_t serialize_to (char* buffer, size_t size) const;
 
 	Type get_castling_type () const { return type; }
 	Piece get_rook_piece () const { return rook_piece; }
 	Square get_rook_from () const { return rook_from; }
 	Square get_rook_to () const { return rook_to; }
+	virtual CompactMove get_compact () const;
 
 	virtual String describe () const;
 
@@ -409,7 +591,7 @@ class StartGame : public Event
 public:
 	StartGame ();
 
-	virtual MLAN serialize () const;
+	virtual size_t serialize_to (char* buffer, size_t size) const;
 
 	virtual Side get_side () const;
 
@@ -425,7 +607,7 @@ class Check : public Event
 public:
 	explicit Check (Side);
 
-	virtual MLAN serialize () const;
+	virtual size_t serialize_to (char* buffer, size_t size) const;
 
 	virtual Side get_side () const;
 
@@ -441,9 +623,17 @@ private:
 
 
 
-// To be implemented appropriately by downstream user.
+// Hooks for the host application. Until they are set, messages are left
+// untranslated and log messages are written to standard error.
+
+typedef String (*Translator) (const String& msgid, Side);
+void set_translator (Translator);
 String translate (const String& msgid, Side = Side::NONE);
 
+typedef void (*Logger) (const String& message);
+void set_logger (Logger);
+void log_message (const String& message);
+
 
 
 } // namespace Chess
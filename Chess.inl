@@ -27,18 +27,6 @@
 
 
 
-namespace Thief {
-
-THIEF_LGMULTI_SPECIALIZE_ (Chess::Piece, LGMulti<int>, Chess::Piece ())
-THIEF_LGMULTI_SPECIALIZE_ (Chess::Side, LGMulti<int>, Chess::Side ())
-
-template<> bool Parameter<Chess::Side>::decode (const String& raw) const;
-template<> String Parameter<Chess::Side>::encode () const;
-
-} // namespace Thief
-
-
-
 namespace Chess {
 
 
@@ -74,13 +62,56 @@ translate_format (const String& msgid, Args... args)
 	}
 	catch (std::exception& e)
 	{
-		Thief::mono.log (boost::format ("WARNING: Could not translate "
-			"message \"%s\": %s.") % msgid % e.what ());
+		log_message ((boost::format ("WARNING: Could not translate "
+			"message \"%s\": %s.") % msgid % e.what ()).str ());
 	}
 	catch (...) {}
 	return String ();
 }
 
+inline
+BufferWriter::BufferWriter (char* _buffer, size_t _size)
+	: buffer (_buffer), size (_size), length (0u)
+{
+	if (size == 0u) throw std::length_error ("buffer too small");
+	buffer [0u] = '\0';
+}
+
+inline BufferWriter&
+BufferWriter::operator << (char c)
+{
+	if (length + 1u >= size) throw std::length_error ("buffer too small");
+	buffer [length++] = c;
+	buffer [length] = '\0';
+	return *this;
+}
+
+inline BufferWriter&
+BufferWriter::operator << (const char* text)
+{
+	while (*text) *this << *text++;
+	return *this;
+}
+
+inline BufferWriter&
+BufferWriter::operator << (unsigned number)
+{
+	char digits [10u];
+	size_t count = 0u;
+	do digits [count++] = char ('0' + number % 10u);
+	while (number /= 10u);
+	while (count) *this << digits [--count];
+	return *this;
+}
+
+inline BufferWriter&
+BufferWriter::operator << (const Square& square)
+{
+	if (!square.is_valid ()) return *this << '-';
+	return *this << char ('a' + char (square.file))
+		<< char ('1' + char (square.rank));
+}
+
 
 
 // Square
@@ -116,6 +147,19 @@ Square::operator != (const Square& rhs) const
 		file != rhs.file || rank != rhs.rank;
 }
 
+inline
+Square::Square (Index index)
+	: file (File (index % N_FILES)), rank (Rank (index / N_FILES))
+{
+	if (index >= COUNT) clear ();
+}
+
+inline Square::Index
+Square::get_index () const
+{
+	return Index (rank) * N_FILES + Index (file);
+}
+
 
 
 // Side
@@ -186,6 +230,298 @@ Piece::operator != (const Piece& rhs) const
 
 
 
+// Bitboard
+
+inline Bitboard
+get_bitboard (Square::Index index)
+{
+	return Bitboard (1u) << index;
+}
+
+inline Bitboard
+get_bitboard (const Square& square)
+{
+	return square.is_valid () ? get_bitboard (square.get_index ()) : 0u;
+}
+
+inline Bitboard
+get_bitboard (File file)
+{
+	return (file > File::NONE && file < File::_COUNT)
+		? (Bitboard (0x0101010101010101u) << size_t (file)) : 0u;
+}
+
+inline Bitboard
+get_bitboard (Rank rank)
+{
+	return (rank > Rank::NONE && rank < Rank::_COUNT)
+		? (Bitboard (0xFFu) << (N_FILES * size_t (rank))) : 0u;
+}
+
+inline Bitboard
+get_bitboard (Square::Color color)
+{
+	switch (color)
+	{
+	case Square::Color::LIGHT: return Bitboard (0x55AA55AA55AA55AAu);
+	case Square::Color::DARK: return Bitboard (0xAA55AA55AA55AA55u);
+	default: return 0u;
+	}
+}
+
+inline unsigned
+count_squares (Bitboard squares)
+{
+	return __builtin_popcountll (squares);
+}
+
+inline Square::Index
+get_first_index (Bitboard squares)
+{
+	return __builtin_ctzll (squares);
+}
+
+inline Square::Index
+get_last_index (Bitboard squares)
+{
+	return 63u - __builtin_clzll (squares);
+}
+
+inline Square::Index
+pop_first_index (Bitboard& squares)
+{
+	Square::Index index = get_first_index (squares);
+	squares &= squares - 1u;
+	return index;
+}
+
+// Parallel bit extraction (BMI2 PEXT). The instruction is emitted directly so
+// that callers need not be built for BMI2; only use if Attacks::USE_PEXT.
+inline Bitboard
+extract_bits (Bitboard source, Bitboard mask)
+{
+#if defined (__x86_64__)
+	Bitboard result;
+	asm ("pextq %2, %1, %0" : "=r" (result) : "r" (source), "r" (mask));
+	return result;
+#elif defined (__i386__)
+	uint32_t low, high;
+	asm ("pextl %2, %1, %0" : "=r" (low)
+		: "r" (uint32_t (source)), "r" (uint32_t (mask)));
+	asm ("pextl %2, %1, %0" : "=r" (high)
+		: "r" (uint32_t (source >> 32)), "r" (uint32_t (mask >> 32)));
+	return low | (Bitboard (high) << __builtin_popcount (uint32_t (mask)));
+#else
+	(void) source; (void) mask;
+	return 0u;
+#endif
+}
+
+
+
+// Attacks
+
+inline Bitboard
+Attacks::king (Square::Index from)
+{
+	return KING [from];
+}
+
+inline Bitboard
+Attacks::knight (Square::Index from)
+{
+	return KNIGHT [from];
+}
+
+inline Bitboard
+Attacks::pawn (Side side, Square::Index from)
+{
+	return side.is_valid () ? PAWN [side.value * Square::COUNT + from] : 0u;
+}
+
+inline Bitboard
+Attacks::between (Square::Index from, Square::Index to)
+{
+	return BETWEEN [from * Square::COUNT + to];
+}
+
+inline Bitboard
+Attacks::line (Square::Index from, Square::Index to)
+{
+	return LINE [from * Square::COUNT + to];
+}
+
+inline size_t
+Attacks::Slider::get_index (Bitboard occupied) const
+{
+	return USE_PEXT ? size_t (extract_bits (occupied, mask))
+		: size_t (((occupied & mask) * magic) >> shift);
+}
+
+inline Bitboard
+Attacks::rook (Square::Index from, Bitboard occupied)
+{
+	return ROOK [from].attacks [ROOK [from].get_index (occupied)];
+}
+
+inline Bitboard
+Attacks::bishop (Square::Index from, Bitboard occupied)
+{
+	return BISHOP [from].attacks [BISHOP [from].get_index (occupied)];
+}
+
+inline Bitboard
+Attacks::queen (Square::Index from, Bitboard occupied)
+{
+	return rook (from, occupied) | bishop (from, occupied);
+}
+
+
+
+// CompactMove
+
+inline
+CompactMove::CompactMove (Square::Index from, Square::Index to,
+		unsigned flags)
+	: value (uint16_t (from | to << 6 | flags << 12))
+{}
+
+inline
+CompactMove::CompactMove (const Square& from, const Square& to,
+		unsigned flags)
+	: value (0u)
+{
+	if (from.is_valid () && to.is_valid ())
+		*this = CompactMove (from.get_index (), to.get_index (), flags);
+}
+
+inline bool
+CompactMove::is_valid () const
+{
+	return get_from_index () != get_to_index ();
+}
+
+inline bool
+CompactMove::operator == (const CompactMove& rhs) const
+{
+	return value == rhs.value;
+}
+
+inline bool
+CompactMove::operator != (const CompactMove& rhs) const
+{
+	return value != rhs.value;
+}
+
+inline Square::Index
+CompactMove::get_from_index () const
+{
+	return value & 0x3Fu;
+}
+
+inline Square::Index
+CompactMove::get_to_index () const
+{
+	return (value >> 6) & 0x3Fu;
+}
+
+inline Square
+CompactMove::get_from () const
+{
+	return is_valid () ? Square (get_from_index ()) : Square ();
+}
+
+inline Square
+CompactMove::get_to () const
+{
+	return is_valid () ? Square (get_to_index ()) : Square ();
+}
+
+inline unsigned
+CompactMove::get_flags () const
+{
+	return value >> 12;
+}
+
+inline bool
+CompactMove::is_capture () const
+{
+	return get_flags () & CAPTURE;
+}
+
+inline bool
+CompactMove::is_en_passant () const
+{
+	return get_flags () == EN_PASSANT;
+}
+
+inline bool
+CompactMove::is_two_square () const
+{
+	return get_flags () == TWO_SQUARE;
+}
+
+inline bool
+CompactMove::is_castling () const
+{
+	return get_flags () == KINGSIDE_CASTLING ||
+		get_flags () == QUEENSIDE_CASTLING;
+}
+
+inline bool
+CompactMove::is_promotion () const
+{
+	return get_flags () & PROMOTION;
+}
+
+inline Piece::Type
+CompactMove::get_promotion () const
+{
+	return is_promotion () ? Piece::Type (4u - (get_flags () & 3u))
+		: Piece::Type::NONE;
+}
+
+inline unsigned
+CompactMove::get_promotion_flags (Piece::Type type)
+{
+	return (type >= Piece::Type::QUEEN && type <= Piece::Type::KNIGHT)
+		? (PROMOTION | (4u - unsigned (type))) : 0u;
+}
+
+
+
+// MoveList
+
+inline
+MoveList::MoveList ()
+	: count (0u)
+{}
+
+inline
+MoveList::MoveList (const MoveList& copy)
+	: count (copy.count)
+{
+	std::copy (copy.begin (), copy.end (), moves);
+}
+
+inline MoveList&
+MoveList::operator = (const MoveList& copy)
+{
+	count = copy.count;
+	std::copy (copy.begin (), copy.end (), moves);
+	return *this;
+}
+
+inline void
+MoveList::push_back (CompactMove move)
+{
+	if (count == CAPACITY)
+		throw std::length_error ("too many moves for list");
+	moves [count++] = move;
+}
+
+
+
 // Event
 
 inline
@@ -0,0 +1,592 @@
+/******************************************************************************
+ *  ChessBench.cc
+ *
+ *  Copyright (C) 2013 Kevin Daughtridge <kevin@kdau.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+// Microbenchmarks of the chess core, built natively with "make native".
+//
+// usage: chess-bench [--json] [--samples N] [name...]
+//        chess-bench --verify DEPTH | --scaling DEPTH [--table MB]
+//        chess-bench --divide DEPTH [FEN]
+//
+// Each benchmark is calibrated to run for at least a few milliseconds per
+// sample, then sampled repeatedly. The median time per operation is robust
+// against scheduling noise; the median absolute deviation shows stability.
+// The other modes check the perft reference counts or report the scaling
+// of multi-threaded perft on Kiwipete, optionally with a shared table.
+// Divide counts the nodes under each legal move of the given position (the
+// initial one by default), for comparison with another generator.
+//
+// The chess-bench-alloc build (CHESS_COUNT_ALLOCATIONS) also counts the heap
+// allocations and bytes allocated per operation.
+
+#include "ChessPerft.hh"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <new>
+#include <sstream>
+
+using namespace Chess;
+
+
+
+// Allocation counting
+
+#ifdef CHESS_COUNT_ALLOCATIONS
+
+// All allocations in the program are counted by replacing the global
+// allocation functions, the nothrow ones included. They are kept out of
+// line so that the compiler doesn't pair the inlined malloc and free with
+// new and delete. The aligned forms only arrive with C++17, so there are
+// none to miss in this build.
+
+static std::atomic<uint64_t> allocation_count (0u), allocation_bytes (0u);
+
+__attribute__ ((noinline)) void*
+operator new (size_t size)
+{
+	allocation_count.fetch_add (1u, std::memory_order_relaxed);
+	allocation_bytes.fetch_add (size, std::memory_order_relaxed);
+	if (void* block = std::malloc (size ? size : 1u))
+		return block;
+	throw std::bad_alloc ();
+}
+
+void*
+operator new[] (size_t size)
+{
+	return operator new (size);
+}
+
+__attribute__ ((noinline)) void
+operator delete (void* block) noexcept
+{
+	std::free (block);
+}
+
+void
+operator delete[] (void* block) noexcept
+{
+	std::free (block);
+}
+
+void*
+operator new (size_t size, const std::nothrow_t&) noexcept
+{
+	try { return operator new (size); }
+	catch (const std::bad_alloc&) { return nullptr; }
+}
+
+void*
+operator new[] (size_t size, const std::nothrow_t&) noexcept
+{
+	return operator new (size, std::nothrow);
+}
+
+void
+operator delete (void* block, const std::nothrow_t&) noexcept
+{
+	std::free (block);
+}
+
+void
+operator delete[] (void* block, const std::nothrow_t&) noexcept
+{
+	std::free (block);
+}
+
+#endif // CHESS_COUNT_ALLOCATIONS
+
+
+
+// Benchmark framework
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Results are folded into this so that the work cannot be optimized away.
+volatile uint64_t sink;
+
+struct Benchmark
+{
+	const char* name;
+	std::function<void (size_t operations)> run;
+};
+
+struct Statistics
+{
+	size_t samples;
+	size_t operations; // per sample
+	double median_ns, mad_ns, min_ns, max_ns; // per operation
+	double allocations, bytes; // per operation, if counted
+};
+
+double
+time_run (const Benchmark& benchmark, size_t operations)
+{
+	auto start = Clock::now ();
+	benchmark.run (operations);
+	return std::chrono::duration<double, std::nano>
+		(Clock::now () - start).count ();
+}
+
+double
+get_median (std::vector<double> values)
+{
+	std::sort (values.begin (), values.end ());
+	size_t middle = values.size () / 2u;
+	return (values.size () % 2u == 1u) ? values [middle]
+		: (values [middle - 1u] + values [middle]) / 2.0;
+}
+
+Statistics
+measure (const Benchmark& benchmark, size_t samples)
+{
+	static const double MIN_SAMPLE_NS = 5e6;
+
+	// Calibrate, which also warms up the caches and branch predictors.
+	Statistics stats;
+	stats.samples = samples;
+	stats.operations = 1u;
+	while (time_run (benchmark, stats.operations) < MIN_SAMPLE_NS)
+		stats.operations *= 2u;
+
+	std::vector<double> times;
+	for (size_t sample = 0u; sample < samples; ++sample)
+		times.push_back (time_run (benchmark, stats.operations)
+			/ stats.operations);
+
+	stats.median_ns = get_median (times);
+	stats.min_ns = *std::min_element (times.begin (), times.end ());
+	stats.max_ns = *std::max_element (times.begin (), times.end ());
+
+	std::vector<double> deviations;
+	for (double time : times)
+		deviations.push_back (std::abs (time - stats.median_ns));
+	stats.mad_ns = get_median (deviations);
+
+	// Count allocations over a separate run so as not to affect timing.
+	stats.allocations = stats.bytes = 0.0;
+#ifdef CHESS_COUNT_ALLOCATIONS
+	uint64_t count = allocation_count, bytes = allocation_bytes;
+	benchmark.run (stats.operations);
+	stats.allocations = double (allocation_count - count)
+		/ stats.operations;
+	stats.bytes = double (allocation_bytes - bytes) / stats.operations;
+#endif
+
+	return stats;
+}
+
+
+
+// Benchmarked operations over the perft reference positions
+
+std::vector<Position>
+get_positions ()
+{
+	std::vector<Position> positions;
+	for (size_t index = 0u; index < Perft::N_REFERENCES; ++index)
+	{
+		std::istringstream fen (Perft::REFERENCES [index].fen);
+		positions.push_back (Position (fen));
+	}
+	return positions;
+}
+
+std::vector<Benchmark>
+get_benchmarks ()
+{
+	std::vector<Benchmark> benchmarks;
+	auto positions = std::make_shared<std::vector<Position>>
+		(get_positions ());
+
+	// Every legal move of every position, for make_move and events
+	struct PositionMove { Position position; CompactMove move; };
+	auto moves = std::make_shared<std::vector<PositionMove>> ();
+	auto mlans = std::make_shared<std::vector<std::pair<MLAN, Side>>> ();
+	auto events = std::make_shared<std::vector<Event::ConstPtr>> ();
+	for (auto& position : *positions)
+	{
+		MoveList list;
+		position.enumerate_moves (list);
+		for (auto move : list)
+		{
+			moves->push_back (PositionMove { position, move });
+			auto event = position.create_move (move);
+			events->push_back (event);
+			mlans->push_back (std::make_pair (event->serialize (),
+				position.get_active_side ()));
+		}
+	}
+
+	auto fens = std::make_shared<std::vector<std::string>> ();
+	for (auto& position : *positions)
+	{
+		std::ostringstream fen;
+		position.serialize (fen);
+		fens->push_back (fen.str ());
+	}
+
+	benchmarks.push_back ({ "make_unmake_move", [=] (size_t operations)
+	{
+		for (size_t index = 0u; index < operations; ++index)
+		{
+			auto& entry = (*moves) [index % moves->size ()];
+			Position::Undo undo;
+			entry.position.make_move (entry.move, undo);
+			sink = sink + entry.position.get_key ();
+			entry.position.unmake_move (entry.move, undo);
+		}
+	}});
+
+	// A line of play from the initial position, as the game would make
+	// it: look up the move by its squares and make it. A new game is
+	// started at the end of the line.
+	auto line = std::make_shared<std::vector<std::pair<Square, Square>>> ();
+	{
+		Position position;
+		for (unsigned ply = 0u; ply < 40u; ++ply)
+		{
+			MoveList list;
+			position.enumerate_moves (list);
+			if (list.empty ()) break;
+			CompactMove move = list [(ply * 7u) % list.size ()];
+			line->push_back (std::make_pair
+				(move.get_from (), move.get_to ()));
+			Position::Undo undo;
+			position.make_move (move, undo);
+		}
+	}
+
+	benchmarks.push_back ({ "game_make_move", [=] (size_t operations)
+	{
+		Game::Ptr game;
+		for (size_t index = 0u; index < operations; ++index)
+		{
+			size_t ply = index % line->size ();
+			if (ply == 0u) game.reset (new Game ());
+			game->make_move (game->find_possible_move
+				((*line) [ply].first, (*line) [ply].second));
+		}
+		sink = sink + game->get_key ();
+	}});
+
+	// Loading the record of that line, in each format
+	auto records = std::make_shared<std::pair<std::string, std::string>> ();
+	{
+		Game game;
+		for (auto& move : *line)
+			game.make_move (game.find_possible_move
+				(move.first, move.second));
+		std::ostringstream text, compact;
+		game.serialize (text);
+		game.serialize_compact (compact);
+		*records = std::make_pair (text.str (), compact.str ());
+	}
+
+	benchmarks.push_back ({ "record_load", [=] (size_t operations)
+	{
+		for (size_t index = 0u; index < operations; ++index)
+		{
+			std::istringstream record (records->first);
+			sink = sink + Game (record).get_key ();
+		}
+	}});
+
+	benchmarks.push_back ({ "compact_record_load", [=] (size_t operations)
+	{
+		for (size_t index = 0u; index < operations; ++index)
+		{
+			std::istringstream record (records->second);
+			sink = sink + Game (record).get_key ();
+		}
+	}});
+
+	benchmarks.push_back ({ "is_in_check", [=] (size_t operations)
+	{
+		for (size_t index = 0u; index < operations; ++index)
+			sink = sink + (*positions) [index % positions->size ()]
+				.is_in_check ();
+	}});
+
+	benchmarks.push_back ({ "is_under_attack", [=] (size_t operations)
+	{
+		for (size_t index = 0u; index < operations; ++index)
+		{
+			auto& position = (*positions)
+				[(index / Square::COUNT) % positions->size ()];
+			sink = sink + position.is_under_attack
+				(Square (Square::Index (index % Square::COUNT)),
+				position.get_active_side ().get_opponent ());
+		}
+	}});
+
+	// The raw generator only. Game::get_possible_moves also caches the list
+	// and indexes it by origin and destination, which game_make_move times.
+	benchmarks.push_back ({ "enumerate_moves", [=] (size_t operations)
+	{
+		MoveList list;
+		for (size_t index = 0u; index < operations; ++index)
+		{
+			(*positions) [index % positions->size ()]
+				.enumerate_moves (list);
+			sink = sink + list.size ();
+		}
+	}});
+
+	// A "has any capture" query stops after the first staged move.
+	benchmarks.push_back ({ "first_capture", [=] (size_t operations)
+	{
+		for (size_t index = 0u; index < operations; ++index)
+		{
+			MoveGenerator generator ((*positions)
+				[index % positions->size ()],
+				MoveGenerator::Mode::CAPTURES);
+			CompactMove move;
+			sink = sink + generator.next (move);
+		}
+	}});
+
+	benchmarks.push_back ({ "fen_parse", [=] (size_t operations)
+	{
+		for (size_t index = 0u; index < operations; ++index)
+		{
+			std::istringstream fen ((*fens) [index % fens->size ()]);
+			sink = sink + Position (fen).get_key ();
+		}
+	}});
+
+	benchmarks.push_back ({ "fen_parse_range", [=] (size_t operations)
+	{
+		for (size_t index = 0u; index < operations; ++index)
+		{
+			auto& fen = (*fens) [index % fens->size ()];
+			sink = sink + Position (fen.data (), fen.data () + fen.size ())
+				.get_key ();
+		}
+	}});
+
+	benchmarks.push_back ({ "fen_serialize", [=] (size_t operations)
+	{
+		for (size_t index = 0u; index < operations; ++index)
+		{
+			std::ostringstream fen;
+			(*positions) [index % positions->size ()].serialize (fen);
+			sink = sink + fen.tellp ();
+		}
+	}});
+
+	benchmarks.push_back ({ "fen_serialize_to", [=] (size_t operations)
+	{
+		char fen [Position::MAX_FEN_LENGTH + 1u];
+		for (size_t index = 0u; index < operations; ++index)
+			sink = sink + (*positions) [index % positions->size ()]
+				.serialize_to (fen, sizeof fen);
+	}});
+
+	benchmarks.push_back ({ "event_deserialize", [=] (size_t operations)
+	{
+		for (size_t index = 0u; index < operations; ++index)
+		{
+			auto& mlan = (*mlans) [index % mlans->size ()];
+			sink = sink + bool (Event::deserialize
+				(mlan.first, mlan.second));
+		}
+	}});
+
+	benchmarks.push_back ({ "event_serialize", [=] (size_t operations)
+	{
+		for (size_t index = 0u; index < operations; ++index)
+			sink = sink + (*events) [index % events->size ()]
+				->serialize ().length ();
+	}});
+
+	benchmarks.push_back ({ "event_serialize_to", [=] (size_t operations)
+	{
+		char mlan [Event::MAX_MLAN_LENGTH + 1u];
+		for (size_t index = 0u; index < operations; ++index)
+			sink = sink + (*events) [index % events->size ()]
+				->serialize_to (mlan, sizeof mlan);
+	}});
+
+	benchmarks.push_back ({ "perft_node", [=] (size_t operations)
+	{
+		// Count whole perft runs until the operations are covered.
+		Perft perft ((*positions) [1u]); // Kiwipete
+		for (uint64_t nodes = 0u; nodes < operations;)
+			nodes += perft.count (2u);
+	}});
+
+	return benchmarks;
+}
+
+
+
+// Output
+
+void
+write_text (std::ostream& out, const Benchmark& benchmark,
+	const Statistics& stats)
+{
+	out << std::left << std::setw (20) << benchmark.name << std::right
+		<< std::fixed << std::setprecision (1)
+		<< std::setw (12) << stats.median_ns << " ns/op"
+		<< "  +/- " << std::setw (8) << stats.mad_ns
+		<< "  [" << stats.min_ns << ", " << stats.max_ns << "]"
+		<< "  " << stats.samples << " x " << stats.operations;
+#ifdef CHESS_COUNT_ALLOCATIONS
+	out << std::setprecision (2) << "  " << stats.allocations
+		<< " allocs/op, " << stats.bytes << " bytes/op";
+#endif
+	out << std::endl;
+}
+
+void
+write_json (std::ostream& out, const Benchmark& benchmark,
+	const Statistics& stats, bool first)
+{
+	out << (first ? "[\n" : ",\n") << std::fixed << std::setprecision (3)
+		<< "  { \"name\": \"" << benchmark.name << "\""
+		<< ", \"median_ns\": " << stats.median_ns
+		<< ", \"mad_ns\": " << stats.mad_ns
+		<< ", \"min_ns\": " << stats.min_ns
+		<< ", \"max_ns\": " << stats.max_ns
+		<< ", \"samples\": " << stats.samples
+		<< ", \"operations\": " << stats.operations;
+#ifdef CHESS_COUNT_ALLOCATIONS
+	out << ", \"allocations_per_op\": " << stats.allocations
+		<< ", \"bytes_per_op\": " << stats.bytes;
+#endif
+	out << " }";
+}
+
+void
+write_division (std::ostream& out, Perft& perft, unsigned depth)
+{
+	Perft::Division division = perft.divide (depth);
+	for (auto& branch : division)
+		out << branch.first.get_uci_code () << ": " << branch.second
+			<< std::endl;
+	out << std::endl << "moves " << division.size ()
+		<< ", nodes " << perft.get_nodes () << " in " << std::fixed
+		<< std::setprecision (3) << perft.get_seconds () << " s ("
+		<< std::setprecision (0) << perft.get_nps () << " nps)"
+		<< std::endl;
+}
+
+} // namespace
+
+
+
+// Main
+
+int
+main (int argc, char** argv)
+{
+	bool json = false;
+	size_t samples = 15u, table_megabytes = 0u;
+	unsigned scaling_depth = 0u, divide_depth = 0u;
+	const char* divide_fen = nullptr;
+	std::vector<String> names;
+	for (int arg = 1; arg < argc; ++arg)
+	{
+		if (std::strcmp (argv [arg], "--json") == 0)
+			json = true;
+		else if (std::strcmp (argv [arg], "--samples") == 0 &&
+		         arg + 1 < argc)
+			samples = std::max (1, std::atoi (argv [++arg]));
+		else if (std::strcmp (argv [arg], "--verify") == 0 &&
+		         arg + 1 < argc)
+			return Perft::verify (std::atoi (argv [++arg]), std::cout)
+				? 0 : 1;
+		else if (std::strcmp (argv [arg], "--scaling") == 0 &&
+		         arg + 1 < argc)
+			scaling_depth = std::max (1, std::atoi (argv [++arg]));
+		else if (std::strcmp (argv [arg], "--table") == 0 &&
+		         arg + 1 < argc)
+			table_megabytes = std::max (0, std::atoi (argv [++arg]));
+		else if (std::strcmp (argv [arg], "--divide") == 0 &&
+		         arg + 1 < argc)
+		{
+			divide_depth = std::max (1, std::atoi (argv [++arg]));
+			if (arg + 1 < argc && argv [arg + 1] [0] != '-')
+				divide_fen = argv [++arg];
+		}
+		else if (argv [arg] [0] == '-')
+		{
+			std::cerr << "usage: " << argv [0]
+				<< " [--json] [--samples N] [name...]\n"
+				<< "       " << argv [0]
+				<< " --verify DEPTH | --scaling DEPTH [--table MB]\n"
+				<< "       " << argv [0] << " --divide DEPTH [FEN]"
+				<< std::endl;
+			return 2;
+		}
+		else
+			names.push_back (argv [arg]);
+	}
+
+	if (divide_depth != 0u)
+	{
+		try
+		{
+			Perft perft { divide_fen ? Position (divide_fen,
+				divide_fen + std::strlen (divide_fen)) : Position () };
+			write_division (std::cout, perft, divide_depth);
+			return 0;
+		}
+		catch (const FENError& error)
+		{
+			std::cerr << error.what () << std::endl;
+			return 2;
+		}
+	}
+
+	if (scaling_depth != 0u)
+	{
+		ParallelPerft::report_scaling (get_positions () [1u],
+			scaling_depth, std::cout, table_megabytes);
+		return 0;
+	}
+
+	bool first = true;
+	for (auto& benchmark : get_benchmarks ())
+	{
+		if (!names.empty () && std::find (names.begin (), names.end (),
+				benchmark.name) == names.end ())
+			continue;
+
+		Statistics stats = measure (benchmark, samples);
+		if (json)
+			write_json (std::cout, benchmark, stats, first);
+		else
+			write_text (std::cout, benchmark, stats);
+		first = false;
+	}
+	if (json)
+		std::cout << (first ? "[]\n" : "\n]\n");
+
+	return 0;
+}
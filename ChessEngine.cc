@@ -19,6 +19,7 @@
  *****************************************************************************/
 
 #include "ChessEngine.hh"
+#include <cstring>
 
 #include <fcntl.h>
 #include <winsock2.h>
@@ -96,10 +97,10 @@ Engine::set_position (const Position& position)
 {
 	if (started)
 	{
-		std::ostringstream fen;
-		fen << "position fen ";
-		position.serialize (fen);
-		write_command (fen.str ());
+		char command [16u + Position::MAX_FEN_LENGTH] = "position fen ";
+		size_t prefix = std::strlen (command);
+		write_command (command, prefix + position.serialize_to
+			(command + prefix, sizeof command - prefix));
 	}
 	else
 		start_game (&position);
@@ -292,11 +293,20 @@ Engine::has_reply () const
 
 void
 Engine::write_command (const String& command)
+{
+	write_command (command.data (), command.size ());
+}
+
+void
+Engine::write_command (const char* command, size_t length)
 {
 	if (!eout) throw std::runtime_error ("no pipe to engine");
-	*eout << command << std::endl;
-	if (debug && command != "isready")
-		Thief::mono << "Chess::Engine <- " << command << std::endl;
+	eout->write (command, length);
+	*eout << std::endl;
+	if (debug && String ("isready").compare (0u, String::npos,
+			command, length) != 0)
+		Thief::mono << "Chess::Engine <- " << String (command, length)
+			<< std::endl;
 }
 
 
@@ -21,6 +21,7 @@
 #ifndef CHESSENGINE_HH
 #define CHESSENGINE_HH
 
+#include <Thief/Thief.hh>
 #include "ChessGame.hh"
 #include <iostream>
 #include <ext/stdio_filebuf.h>
@@ -60,6 +61,7 @@ private:
 	bool has_reply () const;
 
 	void write_command (const String& command);
+	void write_command (const char* command, size_t length);
 
 	typedef __gnu_cxx::stdio_filebuf<char> Buffer;
 	std::unique_ptr<Buffer> ein_buf, eout_buf;
@@ -19,24 +19,90 @@
  *****************************************************************************/
 
 #include "ChessGame.hh"
+#include <cassert>
+#include <cctype>
+#include <climits>
+#include <cstring>
 
 namespace Chess {
 
 
 
-static const Square::Delta
-KING_MOVES[] =
-	{ {1,1}, {1,0}, {1,-1}, {0,-1}, {-1,-1}, {-1,0}, {-1,1}, {0,1} };
+// Zobrist keys
 
-static const Square::Delta
-ROOK_MOVES[] = { {0,1}, {0,-1}, {1,0}, {-1,0} };
+static Position::Key PIECE_KEYS [2u] [Piece::N_TYPES] [Square::COUNT];
+static Position::Key CASTLING_KEYS [16u]; // by white | black << 2
+static Position::Key EN_PASSANT_KEYS [N_FILES];
+static Position::Key BLACK_KEY, NO_SIDE_KEY;
 
-static const Square::Delta
-BISHOP_MOVES[] = { {1,1}, {1,-1}, {-1,-1}, {-1,1} };
+struct KeysInitializer
+{
+	KeysInitializer ();
+};
+
+KeysInitializer::KeysInitializer ()
+{
+	// Fixed xorshift64* sequence, so keys are stable from run to run.
+	uint64_t state = 0x9E3779B97F4A7C15u;
+	auto next = [&state] ()
+	{
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 2685821657736338717u;
+	};
+
+	for (auto& side : PIECE_KEYS)
+		for (auto& type : side)
+			for (auto& square : type)
+				square = next ();
+	for (auto& castling : CASTLING_KEYS)
+		castling = next ();
+	for (auto& file : EN_PASSANT_KEYS)
+		file = next ();
+	BLACK_KEY = next ();
+	NO_SIDE_KEY = next ();
+}
+
+static KeysInitializer keys_initializer;
+
+
+
+// Material keys
+
+static Position::MaterialKey
+get_material_unit (Side side, Piece::Type type, Square::Index index)
+{
+	Position::MaterialField field;
+	switch (type)
+	{
+	case Piece::Type::PAWN: field = Position::PAWNS; break;
+	case Piece::Type::KNIGHT: field = Position::KNIGHTS; break;
+	case Piece::Type::BISHOP:
+		field = (get_bitboard (Square::Color::LIGHT) &
+				get_bitboard (index))
+			? Position::LIGHT_BISHOPS : Position::DARK_BISHOPS;
+		break;
+	case Piece::Type::ROOK: field = Position::ROOKS; break;
+	case Piece::Type::QUEEN: field = Position::QUEENS; break;
+	default: return 0u; // Kings are not counted.
+	}
+	return Position::MaterialKey (1u) <<
+		(4u * (side.value * Position::N_MATERIAL_FIELDS + field));
+}
+
+// The fields of both sides that rule out a dead position
+static constexpr Position::MaterialKey MATERIAL_MAJORS = 0xFF000FFF000Fu;
 
-static const Square::Delta
-KNIGHT_MOVES[] =
-	{ {1,2}, {2,1}, {-1,2}, {-2,1}, {-1,-2}, {-2,-1}, {1,-2}, {2,-1} };
+// Whether only kings and these minor pieces remain is a dead position, by
+// knights (up to two) and presence of light and dark bishops. Dead are:
+// none; one knight; any number of bishops of same square color.
+static constexpr bool DEAD_MINORS [3u] [2u] [2u] =
+{
+	{ { true, true }, { true, false } },
+	{ { true, false }, { false, false } },
+	{ { false, false }, { false, false } }
+};
 
 
 
@@ -48,14 +114,23 @@ Position::INITIAL_BOARD =
 	"\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0pppppppprnbqkbnr";
 
 Position::Position ()
-	: active_side (Side::WHITE),
+	: side_pieces (), type_pieces (),
+	  king_squares { Square::COUNT, Square::COUNT },
+	  active_side (Side::WHITE),
 	  castling_white (unsigned (Castling::Type::BOTH)),
 	  castling_black (unsigned (Castling::Type::BOTH)),
 	  en_passant_square (),
 	  fifty_move_clock (0),
-	  fullmove_number (1)
+	  fullmove_number (1),
+	  key (0u),
+	  material_key (0u)
 {
-	std::memcpy (board, INITIAL_BOARD, sizeof board);
+	std::fill (std::begin (board), std::end (board),
+		int8_t (Piece::Type::NONE));
+	for (auto square = Square::BEGIN; square.is_valid (); ++square)
+		place_piece (square,
+			Piece (INITIAL_BOARD [square.get_index ()]));
+	key ^= get_state_key ();
 }
 
 Position::Position (const Position& copy)
@@ -64,142 +139,251 @@ Position::Position (const Position& copy)
 	  castling_black (copy.castling_black),
 	  en_passant_square (copy.en_passant_square),
 	  fifty_move_clock (copy.fifty_move_clock),
-	  fullmove_number (copy.fullmove_number)
+	  fullmove_number (copy.fullmove_number),
+	  key (copy.key),
+	  material_key (copy.material_key)
 {
+	std::memcpy (side_pieces, copy.side_pieces, sizeof side_pieces);
+	std::memcpy (type_pieces, copy.type_pieces, sizeof type_pieces);
 	std::memcpy (board, copy.board, sizeof board);
+	std::memcpy (king_squares, copy.king_squares, sizeof king_squares);
 }
 
-#define FEN_THROW_INVALID(detail) \
-	throw std::invalid_argument ("invalid FEN: " detail)
-
-#define FEN_EXPECT_CHAR(expected, message) \
-	if (c != expected) \
-		FEN_THROW_INVALID (message);
+static bool is_space (char c) { return std::isspace (uint8_t (c)); }
+static bool is_digit (char c) { return c >= '0' && c <= '9'; }
 
-#define FEN_READ_CHAR(expected, message) \
-	if (!(fen >> c) || c != expected) \
-		FEN_THROW_INVALID (message);
+FENError::FENError (const char* _detail, size_t _column)
+	: std::invalid_argument ((boost::format ("invalid FEN at column %||: %||")
+		% _column % _detail).str ()),
+	  detail (_detail),
+	  column (_column)
+{}
 
 Position::Position (std::istream& fen)
+	: side_pieces (), type_pieces (),
+	  king_squares { Square::COUNT, Square::COUNT },
+	  key (0u),
+	  material_key (0u)
 {
-	char c = '\0';
+	// Collect the fields, of which the clocks are optional, noting where
+	// each one starts both in the stream and in the joined text.
+	const auto eof = std::istream::traits_type::eof ();
+	std::string text;
+	size_t starts [6u], columns [6u], count = 0u, column = 0u;
+	for (; count < 6u; ++count)
+	{
+		for (; fen.peek () != eof && is_space (char (fen.peek ()));
+				++column)
+			fen.get ();
+		if (fen.peek () == eof ||
+		    (count >= 4u && !is_digit (char (fen.peek ()))))
+			break;
+		if (count != 0u) text += ' ';
+		starts [count] = text.size ();
+		columns [count] = column;
+		for (; fen.peek () != eof && !is_space (char (fen.peek ()));
+				++column)
+			text += char (fen.get ());
+	}
+
+	// Report errors at their column in the stream, not the joined text.
+	try
+	{
+		parse_fen (text.data (), text.data () + text.size ());
+	}
+	catch (const FENError& error)
+	{
+		size_t at = error.get_column () - 1u, field = count;
+		while (field != 0u && starts [field - 1u] > at) --field;
+		if (field == 0u) throw;
+		throw FENError (error.get_detail (),
+			columns [field - 1u] + (at - starts [field - 1u]) + 1u);
+	}
+}
+
+Position::Position (const char* begin, const char* end)
+	: side_pieces (), type_pieces (),
+	  king_squares { Square::COUNT, Square::COUNT },
+	  key (0u),
+	  material_key (0u)
+{
+	parse_fen (begin, end);
+}
 
-	std::noskipws (fen); // extract by character
+const char*
+Position::find_fen_end (const char* begin, const char* end)
+{
+	// Four fields, then up to two numeric ones
+	const char* fen_end = begin;
+	for (unsigned index = 0u; index < 6u; ++index)
+	{
+		const char* field = fen_end;
+		while (index != 0u && field != end && is_space (*field))
+			++field;
+		const char* field_end = field;
+		while (field_end != end && !is_space (*field_end))
+			++field_end;
+		if (field == field_end || (index >= 4u &&
+		    !std::all_of (field, field_end, is_digit)))
+			break;
+		fen_end = field_end;
+	}
+	return fen_end;
+}
+
+#define FEN_THROW_INVALID(detail) \
+	throw FENError ("" detail, at - begin + 1u)
+
+#define FEN_EXPECT_CHAR(expected, message) \
+	if (at == end || *at != expected) \
+		FEN_THROW_INVALID (message); \
+	++at;
+
+void
+Position::parse_fen (const char* begin, const char* end)
+{
+	std::fill (std::begin (board), std::end (board),
+		int8_t (Piece::Type::NONE));
+	const char* at = begin;
 
-	size_t rank = N_RANKS, file = 0u; // FEN is backwards rank-wise
-	while (fen >> c)
+	size_t rank = N_RANKS - 1u, file = 0u; // FEN is backwards rank-wise
+	for (;;)
 	{
 		if (file == N_FILES)
 		{
+			if (rank == 0u) break;
+			FEN_EXPECT_CHAR ('/', "expected end of board rank")
+			--rank;
 			file = 0u;
-			if (--rank == 0u)
-			{
-				FEN_EXPECT_CHAR (' ',
-					"expected end of piece placement")
-				break;
-			}
-			else
-				FEN_EXPECT_CHAR ('/',
-					"expected end of board rank")
 		}
-		else if (Piece (c).is_valid ())
-		{
-			board [rank-1] [file++] = c;
-		}
-		else if (c >= '1' && c <= '8' - char (file))
+		else if (at == end)
+			FEN_THROW_INVALID ("incomplete piece placement");
+		else if (*at >= '1' && *at <= '8' - char (file))
+			file += *at++ - '0'; // The squares are already empty.
+		else
 		{
-			size_t blank_count = c - '0';
-			while (blank_count--)
-				board [rank-1] [file++] = Piece::NONE_CODE;
+			Piece piece (*at);
+			if (!piece.is_valid ())
+				FEN_THROW_INVALID ("malformed piece placement");
+			put_piece (rank * N_FILES + file++, piece.side, piece.type);
+			++at;
 		}
-		else
-			FEN_THROW_INVALID ("malformed piece placement");
 	}
-	if (rank != 0u) FEN_THROW_INVALID ("incomplete piece placement");
+	FEN_EXPECT_CHAR (' ', "expected end of piece placement")
 
-	bool got_side = false;
-	while (fen >> c)
+	switch (at == end ? '\0' : *at)
 	{
-		if (c == 'w')
-			active_side = Side::WHITE;
-		else if (c == 'b')
-			active_side = Side::BLACK;
-		else if (c == '-')
-			active_side = Side::NONE; // for completed games
-		else if (c == ' ')
-			break;
-		else
-			FEN_THROW_INVALID ("invalid active side");
-		got_side = true;
+	case 'w': active_side = Side::WHITE; break;
+	case 'b': active_side = Side::BLACK; break;
+	case '-': active_side = Side::NONE; break; // for completed games
+	default: FEN_THROW_INVALID ("invalid active side");
 	}
-	if (!got_side) FEN_THROW_INVALID ("missing active side");
+	++at;
+	FEN_EXPECT_CHAR (' ', "expected end of active side")
 
 	castling_white = unsigned (Castling::Type::NONE);
 	castling_black = unsigned (Castling::Type::NONE);
-	bool got_castling = false;
-	while (fen >> c)
-	{
-		if (c == 'K')
-			castling_white |= unsigned (Castling::Type::KINGSIDE);
-		else if (c == 'Q')
-			castling_white |= unsigned (Castling::Type::QUEENSIDE);
-		else if (c == 'k')
-			castling_black |= unsigned (Castling::Type::KINGSIDE);
-		else if (c == 'q')
-			castling_black |= unsigned (Castling::Type::QUEENSIDE);
-		else if (c == '-')
-			{}
-		else if (c == ' ')
-			break;
-		else
-			FEN_THROW_INVALID ("invalid castling options");
-		got_castling = true;
+	if (at != end && *at == '-')
+		++at;
+	else
+	{
+		const char* options = at;
+		for (; at != end && *at != ' '; ++at)
+			switch (*at)
+			{
+			case 'K':
+				castling_white |= unsigned (Castling::Type::KINGSIDE);
+				break;
+			case 'Q':
+				castling_white |= unsigned (Castling::Type::QUEENSIDE);
+				break;
+			case 'k':
+				castling_black |= unsigned (Castling::Type::KINGSIDE);
+				break;
+			case 'q':
+				castling_black |= unsigned (Castling::Type::QUEENSIDE);
+				break;
+			default:
+				FEN_THROW_INVALID ("invalid castling options");
+			}
+		if (at == options)
+			FEN_THROW_INVALID ("missing castling options");
 	}
-	if (!got_castling) FEN_THROW_INVALID ("missing castling options");
-
-	std::skipws (fen); // extract by token
+	FEN_EXPECT_CHAR (' ', "expected end of castling options")
 
-	if (!fen) FEN_THROW_INVALID ("missing en passant square");
-	String _eps; fen >> _eps;
-	if (_eps == "-")
+	if (at != end && *at == '-')
+	{
 		en_passant_square.clear ();
-	else
+		++at;
+	}
+	else if (end - at >= 2 && at [0u] >= 'a' && at [0u] <= 'h' &&
+		at [1u] == (active_side == Side::WHITE ? '6'
+			: active_side == Side::BLACK ? '3' : '\0'))
 	{
-		Square eps (_eps);
-		if (eps.is_valid ())
-			en_passant_square = eps;
-		else
-			FEN_THROW_INVALID ("invalid en passant square");
+		en_passant_square = Square (File (at [0u] - 'a'),
+			Rank (at [1u] - '1'));
+		at += 2;
 	}
+	else
+		FEN_THROW_INVALID ("invalid en passant square");
 
-	if (!fen) FEN_THROW_INVALID ("missing fifty move clock");
-	fen >> fifty_move_clock;
+	// The clocks are optional, defaulting to a fresh count.
+	unsigned* clocks [2u] = { &fifty_move_clock, &fullmove_number };
+	fifty_move_clock = 0u;
+	fullmove_number = 1u;
+	for (auto clock : clocks)
+	{
+		if (at == end) break;
+		FEN_EXPECT_CHAR (' ', "expected end of field")
+		if (at == end || !is_digit (*at))
+			FEN_THROW_INVALID ("invalid clock");
+		for (*clock = 0u; at != end && is_digit (*at); ++at)
+		{
+			unsigned digit = unsigned (*at - '0');
+			if (*clock > (UINT_MAX - digit) / 10u)
+				FEN_THROW_INVALID ("clock out of range");
+			*clock = *clock * 10u + digit;
+		}
+	}
+	if (at != end) FEN_THROW_INVALID ("unexpected text after FEN");
 
-	if (!fen) FEN_THROW_INVALID ("missing fullmove number");
-	fen >> fullmove_number;
+	key ^= get_state_key ();
 }
 
 void
 Position::serialize (std::ostream& fen) const
 {
+	char text [MAX_FEN_LENGTH + 1u];
+	fen.write (text, serialize_to (text, sizeof text));
+}
+
+size_t
+Position::serialize_to (char* buffer, size_t size) const
+{
+	BufferWriter fen (buffer, size);
+
 	// FEN is backwards, rank-wise.
-	size_t rank = N_RANKS - 1u;
-	do
+	for (size_t rank = N_RANKS; rank-- != 0u;)
 	{
-		size_t file = 0u;
-		while (file < N_FILES)
+		unsigned blank_count = 0u;
+		for (size_t file = 0u; file < N_FILES; ++file)
 		{
-			size_t blank_count = 0u;
-			while (board [rank] [file] == Piece::NONE_CODE &&
-				++blank_count && ++file < N_FILES);
+			Square::Index index = rank * N_FILES + file;
+			if (get_type_at (index) == Piece::Type::NONE)
+			{
+				++blank_count;
+				continue;
+			}
 			if (blank_count != 0u)
 				fen << blank_count;
-			if (file < N_FILES)
-				fen << board [rank] [file++];
+			blank_count = 0u;
+			fen << Piece (get_side_at (index),
+				get_type_at (index)).get_code ();
 		}
+		if (blank_count != 0u)
+			fen << blank_count;
 		if (rank != 0u) fen << '/'; // don't delimit the last one
 	}
-	while (rank-- != 0u);
 
 	fen << ' ' << active_side.get_code ();
 
@@ -211,308 +395,1299 @@ Position::serialize (std::ostream& fen) const
 	if (castling_white == unsigned (Castling::Type::NONE) &&
 	    castling_black == unsigned (Castling::Type::NONE))     fen << '-';
 
-	fen << ' ' << en_passant_square.get_code ();
+	fen << ' ' << en_passant_square;
 	fen << ' ' << fifty_move_clock;
 	fen << ' ' << fullmove_number;
+	return fen.get_length ();
+}
+
+#define PACKED_THROW_INVALID(detail) \
+	throw std::invalid_argument ("invalid packed position: " detail)
+
+Position::Position (const uint8_t* packed)
+	: side_pieces (), type_pieces (),
+	  king_squares { Square::COUNT, Square::COUNT },
+	  key (0u),
+	  material_key (0u)
+{
+	std::fill (std::begin (board), std::end (board),
+		int8_t (Piece::Type::NONE));
+
+	// Each nibble is empty (0) or a piece type plus one, with the high bit
+	// set for black.
+	for (Square::Index index = 0u; index < Square::COUNT; ++index)
+	{
+		unsigned code = (packed [index / 2u] >> (4u * (index % 2u))) & 0xFu;
+		if (code == 0u) continue;
+		if ((code & 7u) == 0u || (code & 7u) > Piece::N_TYPES)
+			PACKED_THROW_INVALID ("invalid piece");
+		put_piece (index, (code & 8u) ? Side::BLACK : Side::WHITE,
+			Piece::Type ((code & 7u) - 1u));
+	}
+
+	uint8_t state = packed [32u];
+	switch (state & 3u)
+	{
+	case 0u: active_side = Side::NONE; break; // for completed games
+	case 1u: active_side = Side::WHITE; break;
+	case 2u: active_side = Side::BLACK; break;
+	default: PACKED_THROW_INVALID ("invalid active side");
+	}
+	castling_white = (state >> 2u) & 3u;
+	castling_black = (state >> 4u) & 3u;
+
+	if (packed [33u] < Square::COUNT)
+		en_passant_square = Square (Square::Index (packed [33u]));
+	else if (packed [33u] == 0xFFu)
+		en_passant_square.clear ();
+	else
+		PACKED_THROW_INVALID ("invalid en passant square");
+
+	fifty_move_clock = packed [34u] | packed [35u] << 8u;
+	fullmove_number = packed [36u] | packed [37u] << 8u;
+
+	key ^= get_state_key ();
+}
+
+void
+Position::pack (uint8_t* packed) const
+{
+	std::fill (packed, packed + PACKED_SIZE, 0u);
+	for (Square::Index index = 0u; index < Square::COUNT; ++index)
+		if (get_type_at (index) != Piece::Type::NONE)
+			packed [index / 2u] |= ((unsigned (board [index]) + 1u) |
+				(get_side_at (index) == Side::BLACK ? 8u : 0u))
+				<< (4u * (index % 2u));
+
+	packed [32u] = uint8_t ((active_side.value + 1) |
+		castling_white << 2u | castling_black << 4u);
+	packed [33u] = en_passant_square.is_valid ()
+		? en_passant_square.get_index () : 0xFFu;
+	packed [34u] = fifty_move_clock & 0xFFu;
+	packed [35u] = (fifty_move_clock >> 8u) & 0xFFu;
+	packed [36u] = fullmove_number & 0xFFu;
+	packed [37u] = (fullmove_number >> 8u) & 0xFFu;
 }
 
 bool
 Position::is_empty (const Square& square) const
 {
-	return !get_piece_at (square).is_valid ();
+	return !(get_occupied () & get_bitboard (square));
+}
+
+Piece
+Position::get_piece_at (const Square& square) const
+{
+	if (!square.is_valid ()) return Piece ();
+	Piece::Type type = get_type_at (square.get_index ());
+	if (type == Piece::Type::NONE) return Piece ();
+
+	return Piece (get_side_at (square.get_index ()), type);
+}
+
+Bitboard
+Position::get_pieces (Side side) const
+{
+	return side.is_valid () ? side_pieces [side.value] : 0u;
+}
+
+Bitboard
+Position::get_pieces (Side side, Piece::Type type) const
+{
+	return (type > Piece::Type::NONE && type < Piece::Type::_COUNT)
+		? (get_pieces (side) & type_pieces [size_t (type)]) : 0u;
+}
+
+Square
+Position::get_king_square (Side side) const
+{
+	return side.is_valid ()
+		? Square (king_squares [side.value]) : Square ();
+}
+
+Castling::Type
+Position::get_castling_options (Side side) const
+{
+	switch (side.value)
+	{
+	case Side::WHITE: return Castling::Type (castling_white);
+	case Side::BLACK: return Castling::Type (castling_black);
+	default: return Castling::Type::NONE;
+	}
+}
+
+bool
+Position::is_under_attack (const Square& square, Side attacker) const
+{
+	if (!square.is_valid () || !attacker.is_valid ()) return false;
+
+	Square::Index index = square.get_index ();
+	return (attacker == Side::WHITE)
+		? is_under_attack<Side::WHITE> (index)
+		: is_under_attack<Side::BLACK> (index);
+}
+
+bool
+Position::is_in_check (Side side) const
+{
+	if (side == Side::NONE) side = active_side;
+	return is_under_attack (get_king_square (side), side.get_opponent ());
+}
+
+bool
+Position::has_legal_move () const
+{
+	switch (active_side.value)
+	{
+	case Side::WHITE: return has_side_legal_move<Side::WHITE> ();
+	case Side::BLACK: return has_side_legal_move<Side::BLACK> ();
+	default: return false;
+	}
+}
+
+bool
+Position::is_checkmate () const
+{
+	return active_side.is_valid () && is_in_check () &&
+		!has_legal_move ();
+}
+
+bool
+Position::is_stalemate () const
+{
+	return active_side.is_valid () && !is_in_check () && !has_legal_move ();
+}
+
+bool
+Position::is_dead () const
+{
+	if (material_key & MATERIAL_MAJORS)
+		return false; // Pawn, rook, or queen = not dead.
+
+	unsigned knights = std::min (2u,
+		get_material_count (material_key, Side::WHITE, KNIGHTS) +
+		get_material_count (material_key, Side::BLACK, KNIGHTS));
+	bool light = get_material_count (material_key, Side::WHITE,
+			LIGHT_BISHOPS) +
+		get_material_count (material_key, Side::BLACK, LIGHT_BISHOPS),
+		dark = get_material_count (material_key, Side::WHITE,
+			DARK_BISHOPS) +
+		get_material_count (material_key, Side::BLACK, DARK_BISHOPS);
+	return DEAD_MINORS [knights] [light] [dark];
+}
+
+unsigned
+Position::get_material_count (MaterialKey material, Side side,
+	MaterialField field)
+{
+	if (!side.is_valid () || field >= N_MATERIAL_FIELDS) return 0u;
+	return (material >> (4u * (side.value * N_MATERIAL_FIELDS + field)))
+		& 0xFu;
+}
+
+bool
+Position::operator == (const Position& rhs) const
+{
+	return key == rhs.key;
+}
+
+void
+Position::make_move (const Move::Ptr& move)
+{
+	if (!move || !move->is_valid ())
+		throw std::runtime_error ("invalid move specified");
+	Undo undo;
+	make_move (*move, undo);
+}
+
+void
+Position::make_move (CompactMove move, Undo& undo)
+{
+	if (!move.is_valid () || !active_side.is_valid ())
+		throw std::runtime_error ("invalid move specified");
+
+	Square::Index from = move.get_from_index (), to = move.get_to_index ();
+	Side side = active_side;
+	Piece::Type type = get_type_at (from);
+	assert (type != Piece::Type::NONE && get_side_at (from) == side);
+
+	undo.captured_piece = Piece ();
+	undo.castling_white = castling_white;
+	undo.castling_black = castling_black;
+	undo.en_passant_square = en_passant_square;
+	undo.fifty_move_clock = fifty_move_clock;
+	undo.key = key;
+	key ^= get_state_key (); // The new state's key is added at the end.
+
+	// Clear any captured square. An en passant capture takes the pawn
+	// beside the origin, on the target file.
+	if (move.is_capture ())
+	{
+		Square::Index captured = move.is_en_passant ()
+			? ((from & ~7u) | (to & 7u)) : to;
+		assert (get_side_at (captured) == side.get_opponent ());
+		undo.captured_piece = Piece (side.get_opponent (),
+			get_type_at (captured));
+		remove_piece (captured, side.get_opponent ());
+
+		// A rook captured on its initial square can no longer castle.
+		if (undo.captured_piece.type == Piece::Type::ROOK)
+			update_castling_options (side.get_opponent (), captured);
+	}
+
+	// Move the piece, promoting it if applicable.
+	remove_piece (from, side);
+	put_piece (to, side, move.is_promotion ()
+		? move.get_promotion () : type);
+
+	// Move any castling rook.
+	if (move.is_castling ())
+	{
+		bool kingside = move.get_flags () ==
+			CompactMove::KINGSIDE_CASTLING;
+		remove_piece (kingside ? to + 1u : to - 2u, side);
+		put_piece (kingside ? to - 1u : to + 1u, side,
+			Piece::Type::ROOK);
+	}
+
+	// Update the castling options.
+	if (type == Piece::Type::KING)
+		((side == Side::WHITE) ? castling_white : castling_black) =
+			unsigned (Castling::Type::NONE);
+	else if (type == Piece::Type::ROOK) // not a new-promoted one
+		update_castling_options (side, from);
+
+	// Move the turn to the opponent.
+	active_side = side.get_opponent ();
+
+	// Update the en passant square.
+	if (move.is_two_square ())
+		en_passant_square = Square ((from + to) / 2u);
+	else
+		en_passant_square.clear ();
+
+	// Update the fifty-move clock.
+	if (type == Piece::Type::PAWN || move.is_capture ())
+		fifty_move_clock = 0;
+	else
+		++fifty_move_clock;
+
+	// Update the fullmove number.
+	if (side == Side::BLACK)
+		++fullmove_number;
+
+	key ^= get_state_key ();
+}
+
+void
+Position::unmake_move (CompactMove move, const Undo& undo)
+{
+	Square::Index from = move.get_from_index (), to = move.get_to_index ();
+	Side side = get_side_at (to);
+
+	// Return any castling rook.
+	if (move.is_castling ())
+	{
+		bool kingside = move.get_flags () ==
+			CompactMove::KINGSIDE_CASTLING;
+		remove_piece (kingside ? to - 1u : to + 1u, side);
+		put_piece (kingside ? to + 1u : to - 2u, side,
+			Piece::Type::ROOK);
+	}
+
+	// Return the piece, unpromoted.
+	Piece::Type type = move.is_promotion ()
+		? Piece::Type::PAWN : get_type_at (to);
+	remove_piece (to, side);
+	put_piece (from, side, type);
+
+	// Restore any captured piece.
+	if (undo.captured_piece.is_valid ())
+		put_piece (move.is_en_passant () ? ((from & ~7u) | (to & 7u)) : to,
+			undo.captured_piece.side, undo.captured_piece.type);
+
+	// Restore the state of play.
+	active_side = side;
+	castling_white = undo.castling_white;
+	castling_black = undo.castling_black;
+	en_passant_square = undo.en_passant_square;
+	fifty_move_clock = undo.fifty_move_clock;
+	key = undo.key;
+	if (side == Side::BLACK)
+		--fullmove_number;
+}
+
+void
+Position::make_move (const Move& move, Undo& undo)
+{
+	make_move (move.get_compact (), undo);
+}
+
+void
+Position::unmake_move (const Move& move, const Undo& undo)
+{
+	unmake_move (move.get_compact (), undo);
+}
+
+Move::Ptr
+Position::create_move (CompactMove move) const
+{
+	if (!move.is_valid ()) return nullptr;
+
+	Square from = move.get_from (), to = move.get_to ();
+	Piece piece = get_piece_at (from);
+
+	switch (move.get_flags ())
+	{
+	case CompactMove::KINGSIDE_CASTLING:
+		return std::make_shared<Castling>
+			(piece.side, Castling::Type::KINGSIDE);
+	case CompactMove::QUEENSIDE_CASTLING:
+		return std::make_shared<Castling>
+			(piece.side, Castling::Type::QUEENSIDE);
+	case CompactMove::TWO_SQUARE:
+		return std::make_shared<TwoSquarePawnMove>
+			(piece.side, from.file);
+	case CompactMove::EN_PASSANT:
+		return std::make_shared<EnPassantCapture>
+			(piece.side, from.file, to.file);
+	default:
+		if (move.is_capture ())
+			return std::make_shared<Capture>
+				(piece, from, to, get_piece_at (to));
+		else
+			return std::make_shared<Move> (piece, from, to);
+	}
+}
+
+void
+Position::place_piece (const Square& square, const Piece& piece)
+{
+	if (!square.is_valid ())
+		throw std::invalid_argument ("invalid square specified");
+	clear_square (square);
+	if (piece.is_valid ())
+		put_piece (square.get_index (), piece.side, piece.type);
+}
+
+void
+Position::clear_square (const Square& square)
+{
+	if (!square.is_valid ())
+		throw std::invalid_argument ("invalid square specified");
+	Square::Index index = square.get_index ();
+	if (get_type_at (index) != Piece::Type::NONE)
+		remove_piece (index, get_side_at (index));
+}
+
+void
+Position::put_piece (Square::Index index, Side side, Piece::Type type)
+{
+	side_pieces [side.value] |= get_bitboard (index);
+	type_pieces [size_t (type)] |= get_bitboard (index);
+	board [index] = int8_t (type);
+	if (type == Piece::Type::KING)
+		king_squares [side.value] = index;
+	key ^= PIECE_KEYS [side.value] [size_t (type)] [index];
+	material_key += get_material_unit (side, type, index);
+}
+
+void
+Position::remove_piece (Square::Index index, Side side)
+{
+	Piece::Type type = get_type_at (index);
+	side_pieces [side.value] &= ~get_bitboard (index);
+	type_pieces [size_t (type)] &= ~get_bitboard (index);
+	board [index] = int8_t (Piece::Type::NONE);
+	if (type == Piece::Type::KING)
+		king_squares [side.value] = Square::COUNT;
+	key ^= PIECE_KEYS [side.value] [size_t (type)] [index];
+	material_key -= get_material_unit (side, type, index);
+}
+
+Side
+Position::get_side_at (Square::Index index) const
+{
+	return (side_pieces [Side::WHITE] & get_bitboard (index))
+		? Side::WHITE : Side::BLACK;
+}
+
+void
+Position::update_castling_options (Side side, Square::Index rook_square)
+{
+	// A rook leaving its corner (by moving or capture) ends its castling.
+	Square::Index corner = (side == Side::WHITE) ? 0u : 56u;
+	unsigned& options = (side == Side::WHITE)
+		? castling_white : castling_black;
+	if (rook_square == corner)
+		options &= ~unsigned (Castling::Type::QUEENSIDE);
+	else if (rook_square == corner + 7u)
+		options &= ~unsigned (Castling::Type::KINGSIDE);
+}
+
+Position::Key
+Position::get_state_key () const
+{
+	Key result = CASTLING_KEYS [castling_white | castling_black << 2];
+	if (active_side == Side::BLACK)
+		result ^= BLACK_KEY;
+	else if (active_side == Side::NONE)
+		result ^= NO_SIDE_KEY;
+	if (en_passant_square.is_valid ())
+		result ^= EN_PASSANT_KEYS [size_t (en_passant_square.file)];
+	return result;
+}
+
+void
+Position::end_game ()
+{
+	key ^= get_state_key ();
+	active_side = Side::NONE;
+	castling_white = unsigned (Castling::Type::NONE);
+	castling_black = unsigned (Castling::Type::NONE);
+	en_passant_square.clear ();
+	fifty_move_clock = 0;
+	// fullmove_number remains valid
+	key ^= get_state_key ();
+}
+
+
+
+// Position: move generation
+
+// Rank and file masks and compile-time shifts for the set-wise pawn moves.
+static constexpr Bitboard FILE_A = 0x0101010101010101u,
+	FILE_H = FILE_A << 7u, RANK_3 = Bitboard (0xFFu) << 16u,
+	RANK_6 = Bitboard (0xFFu) << 40u,
+	PROMOTION_RANKS = 0xFFu | Bitboard (0xFFu) << 56u;
+
+template <int DELTA>
+static constexpr Bitboard
+shift (Bitboard squares)
+{
+	return (DELTA > 0)
+		? squares << (DELTA > 0 ? DELTA : 0)
+		: squares >> (DELTA > 0 ? 0 : -DELTA);
+}
+
+template <Side::Value SIDE>
+struct SideTraits
+{
+	static constexpr Side::Value OPPONENT =
+		(SIDE == Side::WHITE) ? Side::BLACK : Side::WHITE;
+	static constexpr int FORWARD = (SIDE == Side::WHITE) ? 8 : -8;
+	static constexpr Bitboard THIRD_RANK =
+		(SIDE == Side::WHITE) ? RANK_3 : RANK_6;
+	static constexpr Bitboard EN_PASSANT_RANK =
+		(SIDE == Side::WHITE) ? RANK_6 : RANK_3;
+	static constexpr Square::Index HOME = (SIDE == Side::WHITE) ? 0u : 56u;
+};
+
+void
+Position::enumerate_moves (MoveList& moves, bool underpromotions) const
+{
+	enumerate_moves (moves, Stage::ALL, underpromotions);
+}
+
+void
+Position::enumerate_moves (MoveList& moves, Stage stage,
+	bool underpromotions) const
+{
+	moves.clear ();
+	switch (active_side.value)
+	{
+	case Side::WHITE:
+		enumerate_side_moves<Side::WHITE> (moves, stage,
+			underpromotions);
+		break;
+	case Side::BLACK:
+		enumerate_side_moves<Side::BLACK> (moves, stage,
+			underpromotions);
+		break;
+	default:
+		break; // There are no moves without an active side.
+	}
+}
+
+template <Side::Value SIDE>
+void
+Position::enumerate_side_moves (MoveList& moves, Stage stage,
+	bool underpromotions) const
+{
+	if (king_squares [SIDE] == Square::COUNT)
+		return; // There are no moves without a king.
+
+	Constraints constraints = get_constraints<SIDE> ();
+	Bitboard occupied = get_occupied ();
+
+	// Captures land on opposing pieces, promotions on the last rank.
+	constraints.stage = stage;
+	switch (stage)
+	{
+	case Stage::CAPTURES:
+		constraints.targets = side_pieces [SideTraits<SIDE>::OPPONENT];
+		constraints.pushes = PROMOTION_RANKS;
+		break;
+	case Stage::QUIETS:
+		constraints.targets = ~occupied;
+		constraints.pushes = ~PROMOTION_RANKS;
+		break;
+	default:
+		constraints.targets = constraints.pushes = ~Bitboard (0u);
+		break;
+	}
+
+	enumerate_king_moves<SIDE> (moves, constraints);
+	if (constraints.is_double_check ()) return;
+
+	enumerate_pawn_moves<SIDE> (moves, constraints, underpromotions);
+
+	for (Bitboard knights = get_pieces (SIDE, Piece::Type::KNIGHT);
+		knights;)
+	{
+		Square::Index from = pop_first_index (knights);
+		enumerate_targets<SIDE> (moves, constraints, from,
+			Attacks::knight (from));
+	}
+
+	for (Bitboard bishops = get_pieces (SIDE, Piece::Type::BISHOP);
+		bishops;)
+	{
+		Square::Index from = pop_first_index (bishops);
+		enumerate_targets<SIDE> (moves, constraints, from,
+			Attacks::bishop (from, occupied));
+	}
+
+	for (Bitboard rooks = get_pieces (SIDE, Piece::Type::ROOK); rooks;)
+	{
+		Square::Index from = pop_first_index (rooks);
+		enumerate_targets<SIDE> (moves, constraints, from,
+			Attacks::rook (from, occupied));
+	}
+
+	for (Bitboard queens = get_pieces (SIDE, Piece::Type::QUEEN); queens;)
+	{
+		Square::Index from = pop_first_index (queens);
+		enumerate_targets<SIDE> (moves, constraints, from,
+			Attacks::queen (from, occupied));
+	}
+}
+
+template <Side::Value SIDE>
+bool
+Position::has_side_legal_move () const
+{
+	if (king_squares [SIDE] == Square::COUNT)
+		return false;
+
+	Constraints constraints = get_constraints<SIDE> ();
+	constraints.stage = Stage::ALL;
+	constraints.targets = constraints.pushes = ~Bitboard (0u);
+
+	// Pieces are tried one group at a time, most mobile first. Castling
+	// needn't be, as it implies a legal king move to the crossed square.
+	MoveList moves;
+	Bitboard occupied = get_occupied (),
+		kingless = occupied & ~get_bitboard (constraints.king);
+
+	for (Bitboard targets = Attacks::king (constraints.king)
+		& ~side_pieces [SIDE]; targets;)
+		if (!get_attackers<SideTraits<SIDE>::OPPONENT>
+				(pop_first_index (targets), kingless))
+			return true;
+	if (constraints.is_double_check ()) return false;
+
+	for (Bitboard queens = get_pieces (SIDE, Piece::Type::QUEEN); queens;)
+	{
+		Square::Index from = pop_first_index (queens);
+		enumerate_targets<SIDE> (moves, constraints, from,
+			Attacks::queen (from, occupied));
+		if (!moves.empty ()) return true;
+	}
+
+	for (Bitboard rooks = get_pieces (SIDE, Piece::Type::ROOK); rooks;)
+	{
+		Square::Index from = pop_first_index (rooks);
+		enumerate_targets<SIDE> (moves, constraints, from,
+			Attacks::rook (from, occupied));
+		if (!moves.empty ()) return true;
+	}
+
+	for (Bitboard bishops = get_pieces (SIDE, Piece::Type::BISHOP);
+		bishops;)
+	{
+		Square::Index from = pop_first_index (bishops);
+		enumerate_targets<SIDE> (moves, constraints, from,
+			Attacks::bishop (from, occupied));
+		if (!moves.empty ()) return true;
+	}
+
+	for (Bitboard knights = get_pieces (SIDE, Piece::Type::KNIGHT);
+		knights;)
+	{
+		Square::Index from = pop_first_index (knights);
+		enumerate_targets<SIDE> (moves, constraints, from,
+			Attacks::knight (from));
+		if (!moves.empty ()) return true;
+	}
+
+	enumerate_pawn_moves<SIDE> (moves, constraints, false);
+	return !moves.empty ();
+}
+
+template <Side::Value SIDE>
+Position::Constraints
+Position::get_constraints () const
+{
+	constexpr Side::Value OPPONENT = SideTraits<SIDE>::OPPONENT;
+	Constraints constraints;
+	Bitboard occupied = get_occupied ();
+
+	constraints.king = king_squares [SIDE];
+	constraints.checkers =
+		get_attackers<OPPONENT> (constraints.king, occupied);
+
+	// A single check may be blocked or its checker captured. Only the king
+	// itself can escape a double check.
+	switch (count_squares (constraints.checkers))
+	{
+	case 0u:
+		constraints.evasions = ~Bitboard (0u);
+		break;
+	case 1u:
+		constraints.evasions = constraints.checkers |
+			Attacks::between (constraints.king,
+				get_first_index (constraints.checkers));
+		break;
+	default:
+		constraints.evasions = 0u;
+		break;
+	}
+
+	// A friendly piece alone between the king and an opposing slider on
+	// the same line is pinned to that line.
+	Bitboard queens = get_pieces (OPPONENT, Piece::Type::QUEEN);
+	Bitboard snipers =
+		(Attacks::rook (constraints.king, 0u) &
+			(queens | get_pieces (OPPONENT, Piece::Type::ROOK))) |
+		(Attacks::bishop (constraints.king, 0u) &
+			(queens | get_pieces (OPPONENT, Piece::Type::BISHOP)));
+
+	constraints.pinned = 0u;
+	while (snipers)
+	{
+		Bitboard blockers = occupied & Attacks::between
+			(constraints.king, pop_first_index (snipers));
+		if (count_squares (blockers) == 1u)
+			constraints.pinned |= blockers & side_pieces [SIDE];
+	}
+
+	return constraints;
+}
+
+template <Side::Value ATTACKER>
+Bitboard
+Position::get_attackers (Square::Index square, Bitboard occupied) const
+{
+	Bitboard queens = get_pieces (ATTACKER, Piece::Type::QUEEN);
+	return
+		(Attacks::king (square) &
+			get_pieces (ATTACKER, Piece::Type::KING)) |
+		(Attacks::knight (square) &
+			get_pieces (ATTACKER, Piece::Type::KNIGHT)) |
+		// A pawn of the defending side attacks exactly the squares
+		// from which the attacker's pawns could capture.
+		(Attacks::pawn (SideTraits<ATTACKER>::OPPONENT, square) &
+			get_pieces (ATTACKER, Piece::Type::PAWN)) |
+		(Attacks::rook (square, occupied) &
+			(queens | get_pieces (ATTACKER, Piece::Type::ROOK))) |
+		(Attacks::bishop (square, occupied) &
+			(queens | get_pieces (ATTACKER, Piece::Type::BISHOP)));
+}
+
+template <Side::Value ATTACKER>
+bool
+Position::is_under_attack (Square::Index square) const
+{
+	if (get_attackers<ATTACKER> (square, get_occupied ()))
+		return true;
+
+	// Check for en passant capture (behind EPS implies a pawn).
+	return en_passant_square.is_valid () &&
+		int (square) + SideTraits<ATTACKER>::FORWARD ==
+			int (en_passant_square.get_index ()) &&
+		(Attacks::king (square) & get_bitboard (Rank (square / N_FILES))
+			& get_pieces (ATTACKER, Piece::Type::PAWN));
+}
+
+template <Side::Value SIDE>
+void
+Position::enumerate_king_moves (MoveList& moves,
+	const Constraints& constraints) const
+{
+	// Enumerate basic moves. The king mustn't shield the squares behind
+	// it from the attacks it is moving away from.
+
+	Bitboard occupied =
+		get_occupied () & ~get_bitboard (constraints.king);
+	Bitboard targets = Attacks::king (constraints.king)
+		& ~side_pieces [SIDE] & constraints.targets;
+
+	while (targets)
+	{
+		Square::Index to = pop_first_index (targets);
+		if (!get_attackers<SideTraits<SIDE>::OPPONENT> (to, occupied))
+			add_move (moves, constraints.king, to);
+	}
+
+	// Enumerate castling moves.
+
+	if (constraints.checkers || constraints.stage == Stage::CAPTURES)
+		return;
+	enumerate_castling<SIDE> (moves, constraints,
+		Castling::Type::KINGSIDE);
+	enumerate_castling<SIDE> (moves, constraints,
+		Castling::Type::QUEENSIDE);
 }
 
-Piece
-Position::get_piece_at (const Square& square) const
+template <Side::Value SIDE>
+void
+Position::enumerate_castling (MoveList& moves,
+	const Constraints& constraints, Castling::Type type) const
 {
-	return Piece (square.is_valid () ? (*this) [square] : Piece::NONE_CODE);
+	if (!(unsigned (get_castling_options (SIDE)) & unsigned (type)))
+		return;
+
+	// The king and rook must be in place with nothing between them, and
+	// the king cannot pass through or land on an attacked square.
+
+	constexpr Square::Index HOME = SideTraits<SIDE>::HOME;
+	bool kingside = type == Castling::Type::KINGSIDE;
+	Square::Index king_to = HOME + (kingside ? 6u : 2u),
+		rook_from = HOME + (kingside ? 7u : 0u);
+	Bitboard occupied = get_occupied ();
+
+	if (constraints.king != HOME + 4u ||
+	    !(get_pieces (SIDE, Piece::Type::ROOK) &
+			get_bitboard (rook_from)) ||
+	    (Attacks::between (constraints.king, rook_from) & occupied))
+		return;
+
+	for (Bitboard crossed = get_bitboard (king_to) |
+		Attacks::between (constraints.king, king_to); crossed;)
+		if (get_attackers<SideTraits<SIDE>::OPPONENT>
+				(pop_first_index (crossed), occupied))
+			return;
+
+	moves.push_back (CompactMove (constraints.king, king_to, kingside
+		? CompactMove::KINGSIDE_CASTLING
+		: CompactMove::QUEENSIDE_CASTLING));
 }
 
-Castling::Type
-Position::get_castling_options (Side side) const
+template <Side::Value SIDE>
+void
+Position::enumerate_pawn_moves (MoveList& moves,
+	const Constraints& constraints, bool underpromotions) const
 {
-	switch (side.value)
+	typedef SideTraits<SIDE> Traits;
+	constexpr int FORWARD = Traits::FORWARD,
+		WEST = FORWARD - 1, EAST = FORWARD + 1;
+
+	Bitboard pawns = get_pieces (SIDE, Piece::Type::PAWN),
+		occupied = get_occupied (),
+		enemies = side_pieces [Traits::OPPONENT] & constraints.targets;
+
+	// Pinned pawns may only move along the line of their pin.
+	auto is_pinned_away = [&] (Square::Index from, Square::Index to)
 	{
-	case Side::WHITE: return Castling::Type (castling_white);
-	case Side::BLACK: return Castling::Type (castling_black);
-	default: return Castling::Type::NONE;
+		return (constraints.pinned & get_bitboard (from)) &&
+			!(Attacks::line (constraints.king, from) &
+				get_bitboard (to));
+	};
+
+	// Enumerate forward moves.
+
+	Bitboard one_square = shift<FORWARD> (pawns) & ~occupied,
+		two_square = shift<FORWARD> (one_square & Traits::THIRD_RANK)
+			& ~occupied & constraints.evasions & constraints.pushes;
+
+	for (Bitboard targets = one_square & constraints.evasions
+		& constraints.pushes; targets;)
+	{
+		Square::Index to = pop_first_index (targets), from = to - FORWARD;
+		if (!is_pinned_away (from, to))
+			add_move (moves, from, to, underpromotions);
 	}
-}
 
-bool
-Position::is_under_attack (const Square& square, Side attacker) const
-{
-	if (!square.is_valid () || !attacker.is_valid ()) return false;
+	while (two_square)
+	{
+		Square::Index to = pop_first_index (two_square),
+			from = to - 2 * FORWARD;
+		if (!is_pinned_away (from, to))
+			moves.push_back (CompactMove (from, to,
+				CompactMove::TWO_SQUARE));
+	}
 
-	// Check for attacking kings.
-	for (auto& delta : KING_MOVES)
-		if (get_piece_at (square.offset (delta)) ==
-		    Piece (attacker, Piece::Type::KING))
-			return true;
+	// Enumerate captures.
 
-	// Check for attacking queens/rooks.
-	for (auto& delta : ROOK_MOVES)
-		for (Square to = square.offset (delta); to.is_valid ();
-		    to = to.offset (delta))
-			if (get_piece_at (to) ==
-					Piece (attacker, Piece::Type::QUEEN) ||
-			    get_piece_at (to) ==
-					Piece (attacker, Piece::Type::ROOK))
-				return true;
-			else if (!is_empty (to))
-				break; // Can't pass an occupied square.
-
-	// Check for attacking queens/bishops.
-	for (auto& delta : BISHOP_MOVES)
-		for (Square to = square.offset (delta); to.is_valid ();
-		    to = to.offset (delta))
-			if (get_piece_at (to) ==
-					Piece (attacker, Piece::Type::QUEEN) ||
-			    get_piece_at (to) ==
-					Piece (attacker, Piece::Type::BISHOP))
-				return true;
-			else if (!is_empty (to))
-				break; // Can't pass an occupied square.
-
-	// Check for attacking knights.
-	for (auto& delta : KNIGHT_MOVES)
-		if (get_piece_at (square.offset (delta)) ==
-		    Piece (attacker, Piece::Type::KNIGHT))
-			return true;
+	for (Bitboard targets = shift<WEST> (pawns & ~FILE_A) & enemies
+		& constraints.evasions; targets;)
+	{
+		Square::Index to = pop_first_index (targets), from = to - WEST;
+		if (!is_pinned_away (from, to))
+			add_move (moves, from, to, underpromotions);
+	}
 
-	// Check for attacking pawns.
-	int facing = attacker.get_facing_direction ();
-	for (int delta_file : { -1, 1 })
+	for (Bitboard targets = shift<EAST> (pawns & ~FILE_H) & enemies
+		& constraints.evasions; targets;)
 	{
-		if (get_piece_at (square.offset ({ delta_file, -facing })) ==
-		    Piece (attacker, Piece::Type::PAWN))
-			return true;
+		Square::Index to = pop_first_index (targets), from = to - EAST;
+		if (!is_pinned_away (from, to))
+			add_move (moves, from, to, underpromotions);
+	}
+
+	// Enumerate en passant captures. One must capture a checking pawn or
+	// block a check, and removing both pawns from the rank mustn't expose
+	// the king; simulating the capture covers pins as well.
+
+	if (!en_passant_square.is_valid () ||
+	    constraints.stage == Stage::QUIETS)
+		return;
 
-		// Check for en passant capture (behind EPS implies a pawn).
-		if (square.offset ({ 0, facing }) == en_passant_square &&
-		    get_piece_at (square.offset ({ delta_file, 0 })) ==
-				Piece (attacker, Piece::Type::PAWN))
-		        return true;
+	// A square off the opponent's third rank has no pawn behind it.
+	Square::Index to = en_passant_square.get_index ();
+	Bitboard target = get_bitboard (to);
+	if (!(target & Traits::EN_PASSANT_RANK)) return;
+
+	Bitboard captured = get_bitboard (Square::Index (to - FORWARD));
+	if (!(captured & get_pieces (Traits::OPPONENT, Piece::Type::PAWN)) ||
+	    !((constraints.evasions & target) ||
+			(constraints.checkers & captured)))
+		return;
+
+	for (Bitboard capturers = Attacks::pawn (Traits::OPPONENT, to) & pawns;
+		capturers;)
+	{
+		Square::Index from = pop_first_index (capturers);
+		Bitboard after = (occupied & ~get_bitboard (from) & ~captured)
+			| target;
+		if (!(get_attackers<Traits::OPPONENT> (constraints.king, after)
+				& ~captured))
+			moves.push_back (CompactMove (from, to,
+				CompactMove::EN_PASSANT));
 	}
+}
 
-	return false;
+template <Side::Value SIDE>
+void
+Position::enumerate_targets (MoveList& moves,
+	const Constraints& constraints, Square::Index from, Bitboard targets)
+	const
+{
+	// Moves cannot be to friendly-occupied squares, must resolve any
+	// check, and cannot leave a pin's line.
+	targets &= ~side_pieces [SIDE] & constraints.evasions
+		& constraints.targets;
+	if (constraints.pinned & get_bitboard (from))
+		targets &= Attacks::line (constraints.king, from);
+
+	while (targets)
+		add_move (moves, from, pop_first_index (targets));
 }
 
-bool
-Position::is_in_check (Side side) const
+void
+Position::add_move (MoveList& moves, Square::Index from, Square::Index to,
+	bool underpromotions) const
 {
-	if (side == Side::NONE) side = active_side;
-	Side opponent = side.get_opponent ();
-	char king = Piece (side, Piece::Type::KING).get_code ();
+	unsigned flags = 0u;
+	if (get_type_at (to) != Piece::Type::NONE)
+		flags |= CompactMove::CAPTURE;
 
-	for (auto square = Square::BEGIN; square.is_valid (); ++square)
-		if ((*this) [square] == king &&
-		    is_under_attack (square, opponent))
-			return true;
-	return false;
+	if (get_type_at (from) != Piece::Type::PAWN || (to >= 8u && to < 56u))
+	{
+		moves.push_back (CompactMove (from, to, flags));
+		return;
+	}
+
+	// A pawn reaching the last rank promotes to a queen, or to any other
+	// piece if underpromotions are wanted.
+	for (auto type : { Piece::Type::QUEEN, Piece::Type::ROOK,
+		Piece::Type::BISHOP, Piece::Type::KNIGHT })
+	{
+		moves.push_back (CompactMove (from, to, flags |
+			CompactMove::get_promotion_flags (type)));
+		if (!underpromotions) break;
+	}
 }
 
-bool
-Position::is_dead () const
-{
-	// Dead positions with these remaining non-king materials are detected:
-	//   none; one knight; any number of bishops of same square color.
 
-	size_t n_knights = 0u, n_bishops_light = 0u, n_bishops_dark = 0u;
-	for (auto square = Square::BEGIN; square.is_valid (); ++square)
-		switch (get_piece_at (square).type)
-		{
-		case Piece::Type::KING: // Kings don't count here.
-		case Piece::Type::NONE:
-			break;
-		case Piece::Type::KNIGHT:
-			++n_knights;
-			break;
-		case Piece::Type::BISHOP:
-			switch (square.get_color ())
-			{
-			case Square::Color::LIGHT: ++n_bishops_light; break;
-			case Square::Color::DARK: ++n_bishops_dark; break;
-			default: break;
-			}
-			break;
-		default:
-			return false; // Pawn, rook, or queen = not dead.
-		}
 
-	if (n_knights <= 1u && n_bishops_light == 0u && n_bishops_dark == 0u)
-		return true; // none, or one knight
+// MoveGenerator
 
-	if (n_knights > 1u)
-		return false; // knights and bishops
+MoveGenerator::MoveGenerator (const Position& _position, Mode _mode,
+		bool _underpromotions)
+	: position (_position), mode (_mode),
+	  underpromotions (_underpromotions), stage (Position::Stage::ALL),
+	  index (0u)
+{
+	if (mode == Mode::EVASIONS && !position.is_in_check ())
+		return;
 
-	// any number of bishops of same square color
-	return (n_bishops_light == 0u) || (n_bishops_dark == 0u);
+	stage = Position::Stage::CAPTURES;
+	position.enumerate_moves (moves, stage, underpromotions);
 }
 
 bool
-Position::operator == (const Position& rhs) const
+MoveGenerator::next (CompactMove& move)
 {
-	return std::memcmp (board, rhs.board, sizeof board) == 0 &&
-		active_side == rhs.active_side &&
-		castling_white == rhs.castling_white &&
-		castling_black == rhs.castling_black &&
-		(en_passant_square == rhs.en_passant_square ||
-			(!en_passant_square.is_valid () &&
-			 !rhs.en_passant_square.is_valid ()));
+	while (index == moves.size ())
+	{
+		// Quiet moves are only generated once the captures run out.
+		if (stage != Position::Stage::CAPTURES || mode == Mode::CAPTURES)
+		{
+			stage = Position::Stage::ALL;
+			return false;
+		}
+
+		stage = Position::Stage::QUIETS;
+		position.enumerate_moves (moves, stage, underpromotions);
+		index = 0u;
+	}
+
+	move = moves [index++];
+	return true;
 }
 
-void
-Position::make_move (const Move::Ptr& move)
-{
-	if (!move || !move->is_valid ())
-		throw std::runtime_error ("invalid move specified");
 
-	// Promote the piece, if applicable.
-	Piece piece = move->get_piece ();
-	Piece::Type orig_type = piece.type;
-	if (move->get_promoted_piece ().is_valid ())
-		piece = move->get_promoted_piece ();
 
-	// Clear any captured square.
-	auto capture = std::dynamic_pointer_cast<const Capture> (move);
-	if (capture)
-		(*this) [capture->get_captured_square ()] = Piece::NONE_CODE;
+// History
 
-	// Move the piece.
-	(*this) [move->get_from ()] = Piece::NONE_CODE;
-	(*this) [move->get_to ()] = piece.get_code ();
+History::const_iterator::const_iterator (const History& _history,
+		size_t _index)
+	: history (&_history), index (_index)
+{
+	if (index < history->size ())
+		entry = (*history) [index];
+}
 
-	// Move any castling rook.
-	if (auto castling = std::dynamic_pointer_cast<const Castling> (move))
-	{
-		(*this) [castling->get_rook_from ()] = Piece::NONE_CODE;
-		(*this) [castling->get_rook_to ()] =
-			castling->get_rook_piece ().get_code ();
-	}
+History::const_iterator&
+History::const_iterator::operator ++ ()
+{
+	CompactMove played = history->deltas [index].played;
+	if (++index == history->size ())
+		return *this;
 
-	// Update the castling options.
-	unsigned& options = (piece.side == Side::WHITE)
-		? castling_white : castling_black;
-	if (piece.type == Piece::Type::KING)
-		options = unsigned (Castling::Type::NONE);
-	else if (orig_type == Piece::Type::ROOK && // not a new-promoted one
-		 move->get_from ().rank == piece.get_initial_rank ())
+	if (played.is_valid ())
 	{
-		if (move->get_from ().file == File::A)
-			options &= ~unsigned (Castling::Type::QUEENSIDE);
-		else if (move->get_from ().file == File::H)
-			options &= ~unsigned (Castling::Type::KINGSIDE);
+		Position::Undo undo;
+		entry.first.make_move (played, undo);
 	}
+	entry.second = history->deltas [index].event;
+	return *this;
+}
 
-	// Move the turn to the opponent.
-	active_side = move->get_side ().get_opponent ();
-
-	// Update the en passant square.
-	if (auto two_square = std::dynamic_pointer_cast
-	                        <const TwoSquarePawnMove> (move))
-		en_passant_square = two_square->get_passed_square ();
-	else
-		en_passant_square.clear ();
-
-	// Update the fifty-move clock.
-	if (orig_type == Piece::Type::PAWN || capture)
-		fifty_move_clock = 0;
-	else
-		++fifty_move_clock;
+History::const_iterator
+History::const_iterator::operator ++ (int)
+{
+	const_iterator previous = *this;
+	++*this;
+	return previous;
+}
 
-	// Update the fullmove number.
-	if (move->get_side () == Side::BLACK)
-		++fullmove_number;
+HistoryEntry
+History::operator [] (size_t index) const
+{
+	return HistoryEntry (get_position (index), get_event (index));
 }
 
-char&
-Position::operator [] (const Square& square)
+Position
+History::get_position (size_t index) const
 {
-	if (!square.is_valid ())
-		throw std::invalid_argument ("invalid square specified");
-	return board [size_t (square.rank)] [size_t (square.file)];
+	if (index >= size ())
+		throw std::out_of_range ("no such history entry");
+
+	// Replay the moves since the last snapshot.
+	size_t snapshot = index / SNAPSHOT_INTERVAL;
+	Position position (snapshots [snapshot].data ());
+	for (size_t delta = snapshot * SNAPSHOT_INTERVAL; delta < index;
+		++delta)
+		if (deltas [delta].played.is_valid ())
+		{
+			Position::Undo undo;
+			position.make_move (deltas [delta].played, undo);
+		}
+	return position;
 }
 
-const char&
-Position::operator [] (const Square& square) const
+void
+History::push_back (const Position& position, const Event::ConstPtr& event,
+	CompactMove played)
 {
-	if (!square.is_valid ())
-		throw std::invalid_argument ("invalid square specified");
-	return board [size_t (square.rank)] [size_t (square.file)];
+	if (deltas.size () % SNAPSHOT_INTERVAL == 0u)
+	{
+		snapshots.emplace_back ();
+		position.pack (snapshots.back ().data ());
+	}
+	deltas.push_back (Delta { event, played });
 }
 
 void
-Position::end_game ()
+History::clear ()
 {
-	active_side = Side::NONE;
-	castling_white = unsigned (Castling::Type::NONE);
-	castling_black = unsigned (Castling::Type::NONE);
-	en_passant_square.clear ();
-	fifty_move_clock = 0;
-	// fullmove_number remains valid
+	deltas.clear ();
+	snapshots.clear ();
 }
 
 
 
 // Game
 
-Game::Game ()
-	: result (Result::ONGOING),
-	  victor (Side::NONE)
+static const char COMPACT_MAGIC [4u] = { '\x89', 'N', 'G', 'C' };
+static constexpr uint8_t COMPACT_VERSION = 1u;
+static constexpr uint8_t COMPACT_LOSS = 0xFEu, COMPACT_DRAW = 0xFFu;
+
+// 32-bit FNV-1a
+static uint32_t
+get_checksum (const char* data, size_t length)
 {
-	update_possible_moves ();
+	uint32_t sum = 2166136261u;
+	for (size_t index = 0u; index < length; ++index)
+		sum = (sum ^ uint8_t (data [index])) * 16777619u;
+	return sum;
 }
 
+Game::Game ()
+	: result (Result::ONGOING),
+	  victor (Side::NONE),
+	  record_format (RecordFormat::NONE),
+	  possible_moves_current (false),
+	  possible_slots (),
+	  possible_targets ()
+{}
+
 Game::Game (std::istream& record)
-	: Position (record),
-	  result (Result::ONGOING),
-	  victor (Side::NONE)
+	: result (Result::ONGOING),
+	  victor (Side::NONE),
+	  record_format (RecordFormat::NONE),
+	  possible_moves_current (false),
+	  possible_slots (),
+	  possible_targets ()
 {
+	if (record.peek () == uint8_t (COMPACT_MAGIC [0u]))
+	{
+		read_compact (record);
+		record_format = RecordFormat::COMPACT;
+		return;
+	}
+
+	// Parse the record in place, the FEN first.
+	std::string text ((std::istreambuf_iterator<char> (record)),
+		std::istreambuf_iterator<char> ());
+	const char* at = text.data (), * end = at + text.size ();
+	while (at != end && is_space (*at)) ++at;
+	const char* fen_end = find_fen_end (at, end);
+	Position::operator = (Position (at, fen_end));
+
+	// Read the events, following the side and fullmove they imply if
+	// played from the initial position.
+	std::vector<Event::Ptr> events;
 	Side event_side = Side::WHITE;
 	unsigned event_fullmove = 1u;
-	while (!record.eof ())
+	for (at = fen_end;;)
 	{
-		std::string token;
-		record >> token;
-		
-		auto event = Event::deserialize (token, event_side);
+		while (at != end && is_space (*at)) ++at;
+		if (at == end) break;
+		const char* token = at;
+		while (at != end && !is_space (*at)) ++at;
+
+		auto event = Event::deserialize (token, at, event_side);
 		if (!event)
 			throw std::invalid_argument ("invalid event");
-		record_event (event);
+		events.push_back (event);
 
-		if (auto loss = std::dynamic_pointer_cast<Loss> (event))
+		if (std::dynamic_pointer_cast<Move> (event))
 		{
-			result = Result::WON;
-			victor = loss->get_side ().get_opponent ();
+			if (event_side == Side::BLACK) ++event_fullmove;
+			event_side = event_side.get_opponent ();
+		}
+		else
 			event_side = Side::NONE;
+	}
+
+	// An older record holds the position after its events. Those were
+	// played from the initial position, so the game is replayed from
+	// there and checked against the record.
+	Key recorded_key = get_key ();
+	bool older = !events.empty () && get_active_side () == event_side &&
+		get_fullmove_number () == event_fullmove;
+	record_format = older ? RecordFormat::OLDER_TEXT : RecordFormat::TEXT;
+	if (older)
+		Position::operator = (Position ());
+
+	for (auto& event : events)
+		replay_event (event);
+
+	if (older && get_key () != recorded_key)
+		log_message ("WARNING: Chess::Game: The history is not "
+			"consistent with the recorded position.");
+
+	detect_endgames (); // just in case
+}
+
+void
+Game::serialize (std::ostream& record) const
+{
+	if (history.empty ())
+		Position::serialize (record);
+	else
+		history.get_position (0u).serialize (record);
+	serialize_events (record, 0u);
+}
+
+void
+Game::serialize_events (std::ostream& record, size_t first) const
+{
+	char mlan [Event::MAX_MLAN_LENGTH + 1u];
+	for (size_t index = first; index < history.size (); ++index)
+		if (auto& event = history.get_event (index))
+		{
+			record << ' ';
+			record.write (mlan, event->serialize_to (mlan, sizeof mlan));
 		}
-		else if (auto draw = std::dynamic_pointer_cast<Draw> (event))
+}
+
+size_t
+Game::serialize_events (char* buffer, size_t size, size_t first) const
+{
+	size_t length = BufferWriter (buffer, size).get_length ();
+	for (size_t index = first; index < history.size (); ++index)
+		if (auto& event = history.get_event (index))
 		{
-			result = Result::DRAWN;
-			event_side = Side::NONE;
+			length += (BufferWriter (buffer + length, size - length)
+				<< ' ').get_length ();
+			length += event->serialize_to (buffer + length,
+				size - length);
 		}
-		else if (auto move = std::dynamic_pointer_cast<Move> (event))
+	return length;
+}
+
+void
+Game::serialize_compact (std::ostream& record) const
+{
+	std::string payload (PACKED_SIZE, '\0');
+	if (history.empty ())
+		pack ((uint8_t*) &payload [0u]);
+	else
+		history.get_position (0u).pack ((uint8_t*) &payload [0u]);
+
+	// Moves are given by index; an escape byte precedes a loss or draw.
+	for (auto& entry : history)
+	{
+		if (auto move = std::dynamic_pointer_cast<const Move>
+				(entry.second))
 		{
-			if (event_side == Side::BLACK) ++event_fullmove;
-			event_side = event_side.get_opponent ();
+			MoveList moves;
+			entry.first.enumerate_moves (moves);
+			auto found = std::find (moves.begin (), moves.end (),
+				move->get_compact ());
+			if (found == moves.end ())
+				throw std::runtime_error ("history is inconsistent");
+			payload += char (found - moves.begin ());
+		}
+		else if (auto loss = std::dynamic_pointer_cast<const Loss>
+				(entry.second))
+		{
+			payload += char (COMPACT_LOSS);
+			payload += char (unsigned (loss->get_type ()) |
+				unsigned (loss->get_side ().value) << 4u);
+		}
+		else if (auto draw = std::dynamic_pointer_cast<const Draw>
+				(entry.second))
+		{
+			payload += char (COMPACT_DRAW);
+			payload += char (draw->get_type ());
 		}
 	}
-	if (get_fullmove_number () != event_fullmove)
-		Thief::mono.log ("WARNING: Chess::Game: The history is not"
-			"consistent with the recorded position.");
 
-	update_possible_moves ();
+	uint32_t sum = get_checksum (payload.data (), payload.size ());
+	record.write (COMPACT_MAGIC, sizeof COMPACT_MAGIC);
+	record.put (char (COMPACT_VERSION));
+	for (unsigned byte = 0u; byte < 4u; ++byte)
+		record.put (char ((sum >> (8u * byte)) & 0xFFu));
+	record.write (payload.data (), payload.size ());
+}
+
+void
+Game::read_compact (std::istream& record)
+{
+	char magic [sizeof COMPACT_MAGIC];
+	uint8_t header [5u];
+	if (!record.read (magic, sizeof magic) ||
+	    !std::equal (magic, magic + sizeof magic, COMPACT_MAGIC) ||
+	    !record.read ((char*) header, sizeof header))
+		throw std::invalid_argument ("invalid compact record header");
+	if (header [0u] != COMPACT_VERSION)
+		throw std::invalid_argument
+			("unsupported compact record version");
+
+	std::string payload ((std::istreambuf_iterator<char> (record)),
+		std::istreambuf_iterator<char> ());
+	uint32_t sum = header [1u] | header [2u] << 8u | header [3u] << 16u |
+		uint32_t (header [4u]) << 24u;
+	if (payload.size () < PACKED_SIZE ||
+	    sum != get_checksum (payload.data (), payload.size ()))
+		throw std::invalid_argument ("corrupt compact record");
+
+	auto data = (const uint8_t*) payload.data ();
+	Position::operator = (Position (data));
+
+	for (size_t offset = PACKED_SIZE; offset < payload.size (); ++offset)
+	{
+		uint8_t code = data [offset];
+		if ((code == COMPACT_LOSS || code == COMPACT_DRAW) &&
+		    ++offset == payload.size ())
+			throw std::invalid_argument ("truncated compact record");
+
+		Event::ConstPtr event;
+		if (code == COMPACT_LOSS)
+			event = std::make_shared<Loss>
+				(Loss::Type (data [offset] & 0xFu),
+				Side (Side::Value (data [offset] >> 4u)));
+		else if (code == COMPACT_DRAW)
+			event = std::make_shared<Draw>
+				(Draw::Type (data [offset]));
+		else if (code < get_possible_moves ().size ())
+			event = create_move (get_possible_moves () [code]);
+
+		if (!event || !event->is_valid ())
+			throw std::invalid_argument ("invalid compact event");
+		replay_event (event);
+	}
+
 	detect_endgames (); // just in case
 }
 
 void
-Game::serialize (std::ostream& record)
+Game::replay_event (const Event::ConstPtr& event)
 {
-	Position::serialize (record);
-	for (auto& entry : history)
-		if (entry.second)
-			record << ' ' << entry.second->serialize ();
+	if (auto move = std::dynamic_pointer_cast<const Move> (event))
+		make_move (move);
+
+	// A checkmate, stalemate or dead position was already detected when
+	// the move before it was replayed.
+	else if (result != Result::ONGOING && *event == *get_last_event ())
+		return;
+
+	else if (auto loss = std::dynamic_pointer_cast<const Loss> (event))
+	{
+		record_event (event);
+		end_game (Result::WON, loss->get_side ().get_opponent ());
+	}
+	else if (std::dynamic_pointer_cast<const Draw> (event))
+	{
+		record_event (event);
+		end_game (Result::DRAWN, Side::NONE);
+	}
 }
 
 String
@@ -539,26 +1714,27 @@ Game::get_halfmove_prefix (unsigned halfmove)
 Event::ConstPtr
 Game::get_last_event () const
 {
-	return history.empty () ? nullptr : history.back ().second;
+	return history.empty () ? nullptr
+		: history.get_event (history.size () - 1u);
 }
 
 bool
 Game::is_third_repetition () const
 {
-	unsigned repetitions = 1u;
-	for (auto& entry : history)
-		if (*this == entry.first && ++repetitions == 3u)
-			return true;
-	return false;
+	// The current position is the third occurrence if it was recorded
+	// twice before.
+	auto entry = repetitions.find (get_key ());
+	return entry != repetitions.end () && entry->second >= 2u;
 }
 
 Move::Ptr
 Game::find_possible_move (const Square& from, const Square& to) const
 {
-	for (auto& move : possible_moves)
-		if (move && move->get_from () == from && move->get_to () == to)
-			return move;
-	return nullptr;
+	CompactMove wanted (from, to);
+	if (!wanted.is_valid ()) return nullptr;
+	auto move = lookup_possible_move (wanted.get_from_index (),
+		wanted.get_to_index ());
+	return move ? create_move (*move) : nullptr;
 }
 
 Move::Ptr
@@ -591,20 +1767,23 @@ Game::make_move (const Move::Ptr& move)
 	if (!move)
 		throw std::runtime_error ("no move specified");
 
-	bool possible = false;
-	for (auto& possible_move : possible_moves)
-		if (*move == *possible_move)
-		{
-			possible = true;
-			break;
-		}
-
-	if (!possible)
+	// The move must match a possible move in every detail, not just in its
+	// compact form, so its pieces are checked against the board too.
+	CompactMove compact = move->get_compact ();
+	auto possible = compact.is_valid () ? lookup_possible_move
+		(compact.get_from_index (), compact.get_to_index ()) : nullptr;
+	if (!possible || !(*possible == compact) ||
+	    !(move->get_piece () == get_piece_at (move->get_from ())) ||
+	    (compact.is_capture () && !(static_cast<const Capture&> (*move)
+			.get_captured_piece () == get_piece_at
+			(static_cast<const Capture&> (*move)
+				.get_captured_square ()))))
 		throw std::runtime_error ("move not currently possible");
 
-	record_event (move);
-	Position::make_move (move);
-	update_possible_moves ();
+	record_event (move, compact);
+	Undo undo;
+	Position::make_move (compact, undo);
+	invalidate_possible_moves ();
 	detect_endgames ();
 }
 
@@ -686,9 +1865,14 @@ Game::record_war_result (Side _victor)
 }
 
 void
-Game::record_event (const Event::ConstPtr& event)
+Game::record_event (const Event::ConstPtr& event, CompactMove played)
 {
-	history.push_back (HistoryEntry (*this, event));
+	history.push_back (*this, event, played);
+
+	// No position before an irreversible move can recur after it.
+	if (get_fifty_move_clock () == 0u)
+		repetitions.clear ();
+	++repetitions [get_key ()];
 }
 
 void
@@ -697,7 +1881,7 @@ Game::end_game (Result _result, Side _victor)
 	Position::end_game ();
 	result = _result;
 	victor = _victor;
-	possible_moves.clear ();
+	invalidate_possible_moves ();
 }
 
 void
@@ -715,7 +1899,7 @@ Game::detect_endgames ()
 	}
 
 	// Detect checkmate.
-	else if (possible_moves.empty () && is_in_check ())
+	else if (is_checkmate ())
 	{
 		record_event (std::make_shared<Loss>
 			(Loss::Type::CHECKMATE, get_active_side ()));
@@ -723,189 +1907,49 @@ Game::detect_endgames ()
 	}
 
 	// Detect stalemate.
-	else if (possible_moves.empty ())
+	else if (is_stalemate ())
 	{
 		record_event (std::make_shared<Draw> (Draw::Type::STALEMATE));
 		end_game (Result::DRAWN, Side::NONE);
 	}
 }
 
-void
-Game::update_possible_moves ()
-{
-	possible_moves.clear ();
-
-	for (auto from = Square::BEGIN; from.is_valid (); ++from)
-	{
-		Piece piece = Piece ((*this) [from]);
-		if (piece.side != get_active_side ()) continue;
-		switch (piece.type)
-		{
-		case Piece::Type::KING:
-			enumerate_king_moves (piece, from);
-			break;
-		case Piece::Type::QUEEN:
-			enumerate_rook_moves (piece, from);
-			enumerate_bishop_moves (piece, from);
-			break;
-		case Piece::Type::ROOK:
-			enumerate_rook_moves (piece, from);
-			break;
-		case Piece::Type::BISHOP:
-			enumerate_bishop_moves (piece, from);
-			break;
-		case Piece::Type::KNIGHT:
-			enumerate_knight_moves (piece, from);
-			break;
-		case Piece::Type::PAWN:
-			enumerate_pawn_moves (piece, from);
-			break;
-		default:
-			break;
-		}
-	}
-}
-
-void
-Game::enumerate_king_moves (const Piece& piece, const Square& from)
+const MoveList&
+Game::get_possible_moves () const
 {
-	// Enumerate basic moves.
-
-	for (auto& delta : KING_MOVES)
-		confirm_possible_capture (piece, from, from.offset (delta));
-
-	// Enumerate castling moves.
-
-	if (is_in_check ()) return;
-	Side opponent = piece.side.get_opponent ();
-
-	unsigned options = unsigned (get_castling_options (piece.side));
-
-	if (options & unsigned (Castling::Type::KINGSIDE))
-	{
-		Square rook_to = from.offset ({ 1, 0 }),
-			king_to = from.offset ({ 2, 0 });
-		if (is_empty (rook_to) && !is_under_attack (rook_to, opponent) &&
-		    is_empty (king_to) && !is_under_attack (king_to, opponent))
-			confirm_possible_move (std::make_shared<Castling>
-				(piece.side, Castling::Type::KINGSIDE));
-	}
-
-	if (options & unsigned (Castling::Type::QUEENSIDE))
+	if (!possible_moves_current)
 	{
-		Square rook_to = from.offset ({ -1, 0 }),
-			king_to = from.offset ({ -2, 0 }),
-			rook_pass = from.offset ({ -3, 0 });
-		if (is_empty (rook_to) && !is_under_attack (rook_to, opponent) &&
-		    is_empty (king_to) && !is_under_attack (king_to, opponent)
-		    && is_empty (rook_pass))
-			confirm_possible_move (std::make_shared<Castling>
-				(piece.side, Castling::Type::QUEENSIDE));
-	}
-}
-
-void
-Game::enumerate_rook_moves (const Piece& piece, const Square& from)
-{
-	for (auto& delta : ROOK_MOVES)
-		for (Square to = from; to.is_valid (); to = to.offset (delta))
-		{
-			if (to == from) continue;
-			confirm_possible_capture (piece, from, to);
-			if (!is_empty (to))
-				break; // Can't pass an occupied square.
-		}
-}
+		// Only the targets of the previous list need to be cleared.
+		for (auto& move : possible_moves)
+			possible_targets [move.get_from_index ()] = 0u;
 
-void
-Game::enumerate_bishop_moves (const Piece& piece, const Square& from)
-{
-	for (auto& delta : BISHOP_MOVES)
-		for (Square to = from; to.is_valid (); to = to.offset (delta))
+		enumerate_moves (possible_moves);
+		for (size_t slot = 0u; slot < possible_moves.size (); ++slot)
 		{
-			if (to == from) continue;
-			confirm_possible_capture (piece, from, to);
-			if (!is_empty (to))
-				break; // Can't pass an occupied square.
+			Square::Index from = possible_moves [slot].get_from_index (),
+				to = possible_moves [slot].get_to_index ();
+			possible_slots [from] [to] = uint8_t (slot);
+			possible_targets [from] |= get_bitboard (to);
 		}
-}
-
-void
-Game::enumerate_knight_moves (const Piece& piece, const Square& from)
-{
-	for (auto& delta : KNIGHT_MOVES)
-		confirm_possible_capture (piece, from, from.offset (delta));
-}
-
-void
-Game::enumerate_pawn_moves (const Piece& piece, const Square& from)
-{
-	int facing = piece.side.get_facing_direction ();
-
-	// Enumerate forward moves.
-
-	Square one_square = from.offset ({ 0, facing });
-	if (is_empty (one_square))
-	{
-		confirm_possible_move (std::make_shared<Move>
-			(piece, from, one_square));
-
-		Square two_square = one_square.offset ({ 0, facing });
-		if (is_empty (two_square) &&
-		    from.rank == piece.get_initial_rank ())
-			confirm_possible_move
-				(std::make_shared<TwoSquarePawnMove>
-					(piece.side, from.file));
-	}
-
-	// Enumerate captures. Go directly to confirm_possible_move since the
-	//	capture checks have already been performed.
-
-	for (int delta_file : { -1, 1 })
-	{
-		Square to = from.offset ({ delta_file, facing });
-		if (get_piece_at (to).side == piece.side.get_opponent ())
-			confirm_possible_move (std::make_shared<Capture>
-				(piece, from, to, Piece ((*this) [to])));
-		else if (to == get_en_passant_square ())
-			confirm_possible_move (std::make_shared<EnPassantCapture>
-				(piece.side, from.file, to.file));
+		possible_moves_current = true;
 	}
+	return possible_moves;
 }
 
-bool
-Game::confirm_possible_capture (const Piece& piece, const Square& from,
-	const Square& to)
+Bitboard
+Game::get_possible_targets (const Square& from) const
 {
-	Piece to_occupant = get_piece_at (to);
-		
-	if (piece.side == to_occupant.side)
-		return false; // Move cannot be to a friendly-occupied square.
-
-	else if (to_occupant.is_valid ())
-		return confirm_possible_move (std::make_shared<Capture>
-			(piece, from, to, to_occupant));
-
-	else // The to square is empty.
-		return confirm_possible_move (std::make_shared<Move>
-			(piece, from, to));
+	get_possible_moves ();
+	return from.is_valid () ? possible_targets [from.get_index ()] : 0u;
 }
 
-bool
-Game::confirm_possible_move (const Move::Ptr& move)
+const CompactMove*
+Game::lookup_possible_move (Square::Index from, Square::Index to) const
 {
-	// The move must exist and be basically valid.
-	if (!move || !move->is_valid ())
-		return false;
-
-	// The move cannot place the moving piece's side in check.
-	Position check_test (*this);
-	check_test.make_move (move);
-	if (check_test.is_in_check (move->get_side ()))
-		return false;
-
-	possible_moves.push_back (move);
-	return true;
+	get_possible_moves ();
+	if (!(possible_targets [from] & get_bitboard (to)))
+		return nullptr;
+	return &possible_moves [possible_slots [from] [to]];
 }
 
 
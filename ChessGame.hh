@@ -22,6 +22,9 @@
 #define CHESSGAME_HH
 
 #include "Chess.hh"
+#include <array>
+#include <iterator>
+#include <unordered_map>
 
 namespace Chess {
 
@@ -29,6 +32,19 @@ namespace Chess {
 
 // Position
 
+// Thrown for invalid FEN, with the one-based column of the fault.
+class FENError : public std::invalid_argument
+{
+public:
+	FENError (const char* detail, size_t column);
+	const char* get_detail () const { return detail; }
+	size_t get_column () const { return column; }
+
+private:
+	const char* detail;
+	size_t column;
+};
+
 class Position
 {
 public:
@@ -36,12 +52,36 @@ public:
 	Position (const Position&);
 
 	// serialize is intentionally non-virtual to allow FEN access for Game.
+	// FENError columns count from the stream's position on entry.
 	Position (std::istream& fen);
 	void serialize (std::ostream& fen) const;
 
+	// Writes FEN into a buffer and returns its length. FEN never exceeds
+	// MAX_FEN_LENGTH characters plus the terminator.
+	static constexpr size_t MAX_FEN_LENGTH = 103u;
+	size_t serialize_to (char* buffer, size_t size) const;
+
+	// Parses FEN from a character range in place. The clocks may be left
+	// off, as in EPD. find_fen_end finds the end of the FEN fields that
+	// begin a longer text.
+	Position (const char* begin, const char* end);
+	static const char* find_fen_end (const char* begin, const char* end);
+
+	// Packed form for compact records: a nibble per square, then the
+	// active side and castling options, en passant square and clocks.
+	static constexpr size_t PACKED_SIZE = 38u;
+	explicit Position (const uint8_t* packed);
+	void pack (uint8_t* packed) const;
+
 	bool is_empty (const Square&) const;
 	Piece get_piece_at (const Square&) const;
 
+	Bitboard get_occupied () const
+		{ return side_pieces [Side::WHITE] | side_pieces [Side::BLACK]; }
+	Bitboard get_pieces (Side) const;
+	Bitboard get_pieces (Side, Piece::Type) const;
+	Square get_king_square (Side) const;
+
 	Side get_active_side () const { return active_side; }
 	Castling::Type get_castling_options (Side) const;
 	Square get_en_passant_square () const { return en_passant_square; }
@@ -53,34 +93,300 @@ public:
 	bool is_in_check (Side = Side::NONE) const; // default: active side
 	bool is_dead () const;
 
+	// These stop at the first legal move rather than listing them all.
+	bool has_legal_move () const;
+	bool is_checkmate () const;
+	bool is_stalemate () const;
+
+	// Lists the legal moves available to the active side. Pawns promote
+	// only to queens in play; perft can request the other promotions too.
+	void enumerate_moves (MoveList&, bool underpromotions = false) const;
+
+	// Moves can also be listed in stages: captures, en passant and
+	// promotions first, then the remaining quiet moves.
+	enum class Stage
+	{
+		ALL,
+		CAPTURES,
+		QUIETS
+	};
+	void enumerate_moves (MoveList&, Stage, bool underpromotions = false)
+		const;
+
+	// Creates the full event for a compact move in this position.
+	Move::Ptr create_move (CompactMove) const;
+
+	// Zobrist hash of the position as compared for repetition: pieces,
+	// active side, castling options and en passant file.
+	typedef uint64_t Key;
+	Key get_key () const { return key; }
+
+	// Counts of each side's pieces other than kings, in four-bit fields,
+	// with bishops counted by square color. Positions with the same
+	// material have the same material key.
+	typedef uint64_t MaterialKey;
+	enum MaterialField
+	{
+		PAWNS,
+		KNIGHTS,
+		LIGHT_BISHOPS,
+		DARK_BISHOPS,
+		ROOKS,
+		QUEENS,
+		N_MATERIAL_FIELDS
+	};
+	MaterialKey get_material_key () const { return material_key; }
+	static unsigned get_material_count (MaterialKey, Side, MaterialField);
+
 	// Compares positions according to threefold repetition rule.
 	bool operator == (const Position&) const;
 
 	virtual void make_move (const Move::Ptr&);
 
+	// Plays a move such that it can be taken back with unmake_move. The
+	// record is filled by make_move and must be kept until then. The move
+	// must be legal here: the compact form is trusted, with only debug
+	// assertions that the origin holds a piece of the side to move and
+	// that any capture takes an opponent's piece.
+	struct Undo
+	{
+		Piece captured_piece;
+		unsigned castling_white, castling_black;
+		Square en_passant_square;
+		unsigned fifty_move_clock;
+		Key key;
+	};
+	void make_move (CompactMove, Undo&);
+	void unmake_move (CompactMove, const Undo&);
+	void make_move (const Move&, Undo&);
+	void unmake_move (const Move&, const Undo&);
+
 protected:
-	char& operator [] (const Square&);
-	const char& operator [] (const Square&) const;
+	void place_piece (const Square&, const Piece&);
+	void clear_square (const Square&);
 
 	void end_game ();
 
 private:
-	char board [N_RANKS] [N_FILES];
+	// Unchecked forms of place_piece and clear_square for valid squares.
+	void put_piece (Square::Index, Side, Piece::Type);
+	void remove_piece (Square::Index, Side);
+	Side get_side_at (Square::Index) const;
+	Piece::Type get_type_at (Square::Index index) const
+		{ return Piece::Type (board [index]); }
+	void parse_fen (const char* begin, const char* end);
+
+	void update_castling_options (Side, Square::Index rook_square);
+
+	// Checks and pins on the active side's king, found once per position.
+	struct Constraints
+	{
+		Square::Index king;
+		Bitboard checkers;
+		Bitboard pinned;
+		Bitboard evasions; // targets that resolve any single check
+
+		// Only the king can move out of a double check.
+		bool is_double_check () const { return evasions == 0u; }
+
+		// What the current stage may generate.
+		Stage stage;
+		Bitboard targets; // for moves other than pawn pushes
+		Bitboard pushes;
+	};
+
+	// The generator and attack routines are specialized for each side to
+	// move, which resolves directions and ranks at compile time.
+	template <Side::Value SIDE>
+	void enumerate_side_moves (MoveList&, Stage, bool underpromotions)
+		const;
+	template <Side::Value SIDE>
+	bool has_side_legal_move () const;
+	template <Side::Value SIDE>
+	Constraints get_constraints () const;
+	template <Side::Value ATTACKER>
+	Bitboard get_attackers (Square::Index, Bitboard occupied) const;
+	template <Side::Value ATTACKER>
+	bool is_under_attack (Square::Index) const;
+
+	template <Side::Value SIDE>
+	void enumerate_king_moves (MoveList&, const Constraints&) const;
+	template <Side::Value SIDE>
+	void enumerate_castling (MoveList&, const Constraints&,
+		Castling::Type) const;
+	template <Side::Value SIDE>
+	void enumerate_pawn_moves (MoveList&, const Constraints&,
+		bool underpromotions) const;
+	template <Side::Value SIDE>
+	void enumerate_targets (MoveList&, const Constraints&,
+		Square::Index from, Bitboard targets) const;
+	void add_move (MoveList&, Square::Index from, Square::Index to,
+		bool underpromotions = false) const;
+
+	Key get_state_key () const;
+
+	// The side bitboards double as each side's list of occupied squares.
+	// The types and king squares are kept alongside for direct lookup.
+	Bitboard side_pieces [2u]; // by Side::Value
+	Bitboard type_pieces [Piece::N_TYPES];
+	int8_t board [Square::COUNT]; // Piece::Type, kept to a byte
+	Square::Index king_squares [2u]; // Square::COUNT if absent
 	Side active_side;
 	unsigned castling_white, castling_black;
 	Square en_passant_square;
 	unsigned fifty_move_clock;
 	unsigned fullmove_number;
+	Key key;
+	MaterialKey material_key;
 
 	static const char* INITIAL_BOARD;
 };
 
 
 
-// Game
+// MoveGenerator
+
+// Yields the legal moves of a position stage by stage, so that consumers
+// can stop early. The position must not change during generation.
+class MoveGenerator
+{
+public:
+	enum class Mode
+	{
+		ALL,
+		CAPTURES, // captures, en passant and promotions only
+		EVASIONS // all moves, but only while in check
+	};
+
+	MoveGenerator (const Position&, Mode = Mode::ALL,
+		bool underpromotions = false);
+
+	// Returns false once there are no more moves.
+	bool next (CompactMove&);
 
+	// The stage of the last move yielded, or ALL once finished.
+	Position::Stage get_stage () const { return stage; }
+
+private:
+	const Position& position;
+	Mode mode;
+	bool underpromotions;
+	Position::Stage stage;
+	MoveList moves;
+	size_t index;
+};
+
+
+
+// History
+
+// Each entry pairs an event with the position before it.
 typedef std::pair<Position, Event::ConstPtr> HistoryEntry;
-typedef std::vector<HistoryEntry> History;
+
+// Stores the moves played between packed snapshots of the position, which
+// are taken every SNAPSHOT_INTERVAL entries. Entries are rebuilt on demand;
+// iteration replays one move per step, unless only the events are wanted.
+class History
+{
+	struct Delta
+	{
+		Event::ConstPtr event;
+		CompactMove played;
+	};
+
+public:
+	static constexpr size_t SNAPSHOT_INTERVAL = 16u;
+
+	class const_iterator
+	{
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef HistoryEntry value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const HistoryEntry* pointer;
+		typedef const HistoryEntry& reference;
+
+		const HistoryEntry& operator * () const { return entry; }
+		const HistoryEntry* operator -> () const { return &entry; }
+		const_iterator& operator ++ ();
+		const_iterator operator ++ (int);
+
+		bool operator == (const const_iterator& rhs) const
+			{ return index == rhs.index; }
+		bool operator != (const const_iterator& rhs) const
+			{ return index != rhs.index; }
+
+	private:
+		friend class History;
+		const_iterator (const History&, size_t index);
+
+		const History* history;
+		size_t index;
+		HistoryEntry entry;
+	};
+
+	size_t size () const { return deltas.size (); }
+	bool empty () const { return deltas.empty (); }
+	const_iterator begin () const { return const_iterator (*this, 0u); }
+	const_iterator end () const { return const_iterator (*this, size ()); }
+
+	class event_iterator
+	{
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef Event::ConstPtr value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const Event::ConstPtr* pointer;
+		typedef const Event::ConstPtr& reference;
+
+		const Event::ConstPtr& operator * () const { return at->event; }
+		const Event::ConstPtr* operator -> () const
+			{ return &at->event; }
+		event_iterator& operator ++ () { ++at; return *this; }
+		event_iterator operator ++ (int)
+			{ return event_iterator (at++); }
+
+		bool operator == (const event_iterator& rhs) const
+			{ return at == rhs.at; }
+		bool operator != (const event_iterator& rhs) const
+			{ return at != rhs.at; }
+
+	private:
+		friend class History;
+		explicit event_iterator (const Delta* _at) : at (_at) {}
+
+		const Delta* at;
+	};
+
+	// The events alone, for callers that have no use for the positions.
+	struct Events
+	{
+		event_iterator first, last;
+		event_iterator begin () const { return first; }
+		event_iterator end () const { return last; }
+	};
+	Events get_events () const
+		{ return Events { event_iterator (deltas.data ()),
+			event_iterator (deltas.data () + deltas.size ()) }; }
+
+	HistoryEntry operator [] (size_t index) const;
+	Position get_position (size_t index) const;
+	const Event::ConstPtr& get_event (size_t index) const
+		{ return deltas [index].event; }
+
+	// The move played, if any, leads from the position to the next entry.
+	void push_back (const Position&, const Event::ConstPtr&,
+		CompactMove played = CompactMove ());
+	void clear ();
+
+private:
+	std::vector<Delta> deltas;
+	std::vector<std::array<uint8_t, Position::PACKED_SIZE>> snapshots;
+};
+
+
+
+// Game
 
 class Game : public Position
 {
@@ -90,8 +396,33 @@ public:
 	Game ();
 	Game (const Game&) = delete;
 
+	// A record is the initial position in FEN followed by the MLAN of
+	// each event, so it only grows as the game goes on. Older records,
+	// which begin with the current position instead, are still read.
 	Game (std::istream& record);
-	void serialize (std::ostream& record);
+	void serialize (std::ostream& record) const;
+
+	// Writes the events after the first count, each after a space, to be
+	// appended to a record of the game up to that point.
+	void serialize_events (std::ostream& record, size_t first) const;
+	size_t serialize_events (char* buffer, size_t size, size_t first) const;
+
+	// A compact record has a header with magic, version and checksum. The
+	// initial position follows in packed form, then each move as its
+	// index among the possible moves. Game (std::istream&) reads both
+	// kinds of record.
+	void serialize_compact (std::ostream& record) const;
+
+	// The kind of record the game was read from, if any. Only a current
+	// textual record can have further events appended to it.
+	enum class RecordFormat
+	{
+		NONE,
+		TEXT,
+		OLDER_TEXT,
+		COMPACT
+	};
+	RecordFormat get_record_format () const { return record_format; }
 
 	static String get_logbook_heading (unsigned page);
 	static String get_halfmove_prefix (unsigned halfmove);
@@ -112,7 +443,8 @@ public:
 	Event::ConstPtr get_last_event () const;
 	bool is_third_repetition () const;
 
-	const Moves& get_possible_moves () const { return possible_moves; }
+	const MoveList& get_possible_moves () const;
+	Bitboard get_possible_targets (const Square& from) const;
 	Move::Ptr find_possible_move (const Square& from, const Square& to)
 		const;
 	Move::Ptr find_possible_move (const String& uci_code) const;
@@ -125,27 +457,35 @@ public:
 	void record_war_result (Side victor); // for easter egg
 
 private:
-	void record_event (const Event::ConstPtr&);
+	void read_compact (std::istream& record);
+	void replay_event (const Event::ConstPtr&);
+
+	void record_event (const Event::ConstPtr&,
+		CompactMove played = CompactMove ());
 	void end_game (Result, Side victor);
 	void detect_endgames ();
 
 	Result result;
 	Side victor;
+	RecordFormat record_format;
 	History history;
 
-	// Possible moves
+	// Occurrences of each position since the last irreversible move.
+	std::unordered_map<Position::Key, unsigned> repetitions;
+
+	// Possible moves are only enumerated once they are wanted; the end of
+	// the game is detected without them.
 
-	void update_possible_moves ();
-	void enumerate_king_moves (const Piece&, const Square& from);
-	void enumerate_rook_moves (const Piece&, const Square& from);
-	void enumerate_bishop_moves (const Piece&, const Square& from);
-	void enumerate_knight_moves (const Piece&, const Square& from);
-	void enumerate_pawn_moves (const Piece&, const Square& from);
-	bool confirm_possible_capture (const Piece&,
-		const Square& from, const Square& to);
-	bool confirm_possible_move (const Move::Ptr&);
+	void invalidate_possible_moves () { possible_moves_current = false; }
+	const CompactMove* lookup_possible_move (Square::Index from,
+		Square::Index to) const;
+	mutable MoveList possible_moves;
+	mutable bool possible_moves_current;
 
-	Moves possible_moves;
+	// The possible moves are indexed by origin and destination as they
+	// are listed. A slot is only meaningful if its target bit is set.
+	mutable uint8_t possible_slots [Square::COUNT] [Square::COUNT];
+	mutable Bitboard possible_targets [Square::COUNT]; // by origin
 };
 
 
@@ -0,0 +1,488 @@
+/******************************************************************************
+ *  ChessPerft.cc
+ *
+ *  Copyright (C) 2013 Kevin Daughtridge <kevin@kdau.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#include "ChessPerft.hh"
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <sstream>
+#ifdef _GLIBCXX_HAS_GTHREADS
+#include <mutex>
+#include <thread>
+#endif
+
+namespace Chess {
+
+
+
+// Perft
+
+typedef std::chrono::steady_clock Clock;
+
+static double
+get_seconds_since (Clock::time_point start)
+{
+	return std::chrono::duration<double> (Clock::now () - start).count ();
+}
+
+static uint64_t
+count_nodes (Position& position, unsigned depth, PerftTable* table)
+{
+	MoveList moves;
+	position.enumerate_moves (moves, true);
+	if (depth == 1u)
+		return moves.size (); // The leaves needn't be played.
+
+	uint64_t result = 0u;
+	if (table && table->probe (position.get_key (), depth, result))
+		return result;
+
+	for (auto move : moves)
+	{
+		Position::Undo undo;
+		position.make_move (move, undo);
+		result += count_nodes (position, depth - 1u, table);
+		position.unmake_move (move, undo);
+	}
+
+	if (table)
+		table->store (position.get_key (), depth, result);
+	return result;
+}
+
+Perft::Perft (const Position& _root)
+	: root (_root), nodes (0u), seconds (0.0)
+{}
+
+uint64_t
+Perft::count (unsigned depth)
+{
+	auto start = Clock::now ();
+	Position position (root);
+	nodes = (depth == 0u) ? 1u : count_nodes (position, depth, nullptr);
+	seconds = get_seconds_since (start);
+	return nodes;
+}
+
+Perft::Division
+Perft::divide (unsigned depth)
+{
+	auto start = Clock::now ();
+	Division division;
+	nodes = 0u;
+
+	Position position (root);
+	MoveList moves;
+	position.enumerate_moves (moves, true);
+	for (auto move : moves)
+	{
+		Position::Undo undo;
+		position.make_move (move, undo);
+		uint64_t branch = (depth <= 1u) ? 1u
+			: count_nodes (position, depth - 1u, nullptr);
+		position.unmake_move (move, undo);
+
+		division.push_back (Branch (move, branch));
+		nodes += branch;
+	}
+
+	seconds = get_seconds_since (start);
+	return division;
+}
+
+double
+Perft::get_nps () const
+{
+	return (seconds > 0.0) ? nodes / seconds : 0.0;
+}
+
+const Perft::Reference
+Perft::REFERENCES [] =
+{
+	{ "initial",
+		"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+		{ 20u, 400u, 8902u, 197281u, 4865609u, 119060324u } },
+	{ "kiwipete",
+		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+		{ 48u, 2039u, 97862u, 4085603u, 193690690u, 0u } },
+	{ "en-passant",
+		"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+		{ 14u, 191u, 2812u, 43238u, 674624u, 11030083u } },
+	{ "promotion",
+		"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+		{ 6u, 264u, 9467u, 422333u, 15833292u, 706045033u } },
+	{ "promotion-mirrored",
+		"r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+		{ 6u, 264u, 9467u, 422333u, 15833292u, 706045033u } },
+	{ "castling",
+		"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+		{ 44u, 1486u, 62379u, 2103487u, 89941194u, 0u } },
+	{ "middlegame",
+		"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+		{ 46u, 2079u, 89890u, 3894594u, 164075551u, 6923051137u } },
+};
+
+const size_t
+Perft::N_REFERENCES = sizeof (REFERENCES) / sizeof (REFERENCES [0u]);
+
+bool
+Perft::verify (unsigned max_depth, std::ostream& log)
+{
+	bool passed = true;
+	for (size_t index = 0u; index < N_REFERENCES; ++index)
+	{
+		const Reference& reference = REFERENCES [index];
+		std::istringstream fen (reference.fen);
+		Perft perft { Position (fen) };
+
+		for (unsigned depth = 1u; depth <= max_depth &&
+			depth <= MAX_REFERENCE_DEPTH; ++depth)
+		{
+			uint64_t expected = reference.nodes [depth - 1u];
+			if (expected == 0u) break;
+
+			uint64_t actual = perft.count (depth);
+			log << reference.name << " depth " << depth << ": "
+				<< actual << " nodes in " << std::fixed
+				<< std::setprecision (3) << perft.get_seconds ()
+				<< " s (" << std::setprecision (0)
+				<< perft.get_nps () << " nps)";
+			if (actual == expected)
+				log << std::endl;
+			else
+			{
+				log << " MISMATCH: expected " << expected
+					<< std::endl;
+				passed = false;
+			}
+		}
+	}
+	return passed;
+}
+
+
+
+// PerftTable
+
+PerftTable::PerftTable (size_t megabytes)
+	: mask (0u)
+{
+	// Use the largest power of two number of entries that fits.
+	size_t count = 1u;
+	while (count * 2u * sizeof (Entry) <= megabytes * 1048576u)
+		count *= 2u;
+	entries.reset (new Entry [count]);
+	mask = count - 1u;
+	for (size_t index = 0u; index < count; ++index)
+	{
+		entries [index].check.store (0u, std::memory_order_relaxed);
+		entries [index].data.store (0u, std::memory_order_relaxed);
+	}
+}
+
+bool
+PerftTable::probe (Position::Key key, unsigned depth, uint64_t& nodes) const
+{
+	Entry& entry = get_entry (key, depth);
+	uint64_t data = entry.data.load (std::memory_order_relaxed),
+		check = entry.check.load (std::memory_order_relaxed);
+	if ((check ^ data) != key || (data >> 56) != depth)
+		return false;
+	nodes = data & ((uint64_t (1u) << 56) - 1u);
+	return true;
+}
+
+void
+PerftTable::store (Position::Key key, unsigned depth, uint64_t nodes)
+{
+	Entry& entry = get_entry (key, depth);
+	uint64_t data = nodes | uint64_t (depth) << 56;
+	entry.check.store (key ^ data, std::memory_order_relaxed);
+	entry.data.store (data, std::memory_order_relaxed);
+}
+
+PerftTable::Entry&
+PerftTable::get_entry (Position::Key key, unsigned depth) const
+{
+	// Spread the depths of one position over different entries.
+	return entries [(key ^ (depth * 0x9E3779B97F4A7C15u)) & mask];
+}
+
+
+
+// ParallelPerft
+
+ParallelPerft::ParallelPerft (const Position& _root, unsigned _threads,
+		PerftTable* _table)
+	: root (_root), threads (_threads), table (_table),
+	  nodes (0u), seconds (0.0)
+{
+#ifdef _GLIBCXX_HAS_GTHREADS
+	if (threads == 0u)
+		threads = std::thread::hardware_concurrency ();
+#endif
+	if (threads == 0u)
+		threads = 1u;
+}
+
+#ifdef _GLIBCXX_HAS_GTHREADS
+
+namespace {
+
+// A task that was split into one per legal move, awaiting their counts.
+// The last child to finish passes the sum on and stores it in the table.
+struct PerftSplit
+{
+	PerftSplit (Position::Key _key, unsigned _depth,
+			const std::shared_ptr<PerftSplit>& _parent, size_t children)
+		: key (_key), depth (_depth), parent (_parent),
+		  nodes (0u), remaining (children)
+	{}
+
+	Position::Key key;
+	unsigned depth;
+	std::shared_ptr<PerftSplit> parent; // none for the root
+	std::atomic<uint64_t> nodes;
+	std::atomic<size_t> remaining;
+};
+
+struct PerftTask
+{
+	Position position;
+	unsigned depth;
+	std::shared_ptr<PerftSplit> parent;
+};
+
+// Each worker takes tasks from the back of its own queue and splits them
+// there, keeping its work deep and local. An idle worker steals from the
+// front of another's queue, where the largest remaining subtrees are.
+struct PerftWorker
+{
+	std::mutex mutex;
+	std::deque<PerftTask> tasks;
+};
+
+class PerftPool
+{
+public:
+	PerftPool (unsigned threads, PerftTable* table);
+	uint64_t count (const Position& root, unsigned depth);
+
+private:
+	void work (size_t self);
+	bool take_task (size_t self, PerftTask&);
+	void run_task (size_t self, PerftTask&);
+	void complete (std::shared_ptr<PerftSplit>, uint64_t nodes);
+
+	std::vector<std::unique_ptr<PerftWorker>> workers;
+	PerftTable* table;
+	std::atomic<uint64_t> total;
+	std::atomic<size_t> pending; // tasks queued or running
+};
+
+PerftPool::PerftPool (unsigned threads, PerftTable* _table)
+	: table (_table), total (0u), pending (0u)
+{
+	for (unsigned index = 0u; index < threads; ++index)
+		workers.emplace_back (new PerftWorker);
+}
+
+uint64_t
+PerftPool::count (const Position& root, unsigned depth)
+{
+	total = 0u;
+	pending = 1u;
+	workers.front ()->tasks.push_back (PerftTask { root, depth, nullptr });
+
+	std::vector<std::thread> threads;
+	for (size_t index = 1u; index < workers.size (); ++index)
+		threads.emplace_back (&PerftPool::work, this, index);
+	work (0u);
+	for (auto& thread : threads)
+		thread.join ();
+
+	return total;
+}
+
+void
+PerftPool::work (size_t self)
+{
+	PerftTask task;
+	while (pending.load () != 0u)
+	{
+		if (take_task (self, task))
+			run_task (self, task);
+		else
+			std::this_thread::yield ();
+	}
+}
+
+bool
+PerftPool::take_task (size_t self, PerftTask& task)
+{
+	for (size_t offset = 0u; offset < workers.size (); ++offset)
+	{
+		PerftWorker& worker = *workers [(self + offset) % workers.size ()];
+		std::lock_guard<std::mutex> lock (worker.mutex);
+		if (worker.tasks.empty ()) continue;
+
+		if (offset == 0u)
+		{
+			task = worker.tasks.back ();
+			worker.tasks.pop_back ();
+		}
+		else
+		{
+			task = worker.tasks.front ();
+			worker.tasks.pop_front ();
+		}
+		return true;
+	}
+	return false;
+}
+
+void
+PerftPool::run_task (size_t self, PerftTask& task)
+{
+	uint64_t result = 0u;
+	if (task.depth <= ParallelPerft::SERIAL_DEPTH)
+		result = count_nodes (task.position, task.depth, table);
+	else if (!table || !table->probe (task.position.get_key (),
+			task.depth, result))
+	{
+		// Split the task into one per legal move.
+		MoveList moves;
+		task.position.enumerate_moves (moves, true);
+		if (!moves.empty ())
+		{
+			std::shared_ptr<PerftSplit> split (new PerftSplit
+				(task.position.get_key (), task.depth, task.parent,
+					moves.size ()));
+			std::vector<PerftTask> children (moves.size (),
+				PerftTask { task.position, task.depth - 1u, split });
+			for (size_t index = 0u; index < moves.size (); ++index)
+			{
+				Position::Undo undo;
+				children [index].position.make_move (moves [index],
+					undo);
+			}
+
+			pending += children.size ();
+			PerftWorker& worker = *workers [self];
+			std::lock_guard<std::mutex> lock (worker.mutex);
+			worker.tasks.insert (worker.tasks.end (),
+				children.begin (), children.end ());
+			--pending;
+			return;
+		}
+	}
+
+	// The count is passed on before the task stops being pending, so the
+	// total is complete once nothing is.
+	complete (task.parent, result);
+	--pending;
+}
+
+void
+PerftPool::complete (std::shared_ptr<PerftSplit> split, uint64_t nodes)
+{
+	for (; split; split = split->parent)
+	{
+		split->nodes += nodes;
+		if (--split->remaining != 0u) return;
+
+		nodes = split->nodes.load ();
+		if (table)
+			table->store (split->key, split->depth, nodes);
+	}
+	total += nodes;
+}
+
+} // namespace
+
+#endif // _GLIBCXX_HAS_GTHREADS
+
+uint64_t
+ParallelPerft::count (unsigned depth)
+{
+	auto start = Clock::now ();
+	if (depth == 0u)
+		nodes = 1u;
+	else
+	{
+#ifdef _GLIBCXX_HAS_GTHREADS
+		PerftPool pool (threads, table);
+		nodes = pool.count (root, depth);
+#else
+		// Without thread support, count serially.
+		Position position (root);
+		nodes = count_nodes (position, depth, table);
+#endif
+	}
+	seconds = get_seconds_since (start);
+	return nodes;
+}
+
+double
+ParallelPerft::get_nps () const
+{
+	return (seconds > 0.0) ? nodes / seconds : 0.0;
+}
+
+void
+ParallelPerft::report_scaling (const Position& root, unsigned depth,
+	std::ostream& log, size_t table_megabytes)
+{
+	unsigned max_threads = ParallelPerft (root).get_threads ();
+	double base_seconds = 0.0;
+	if (table_megabytes != 0u)
+		log << "table " << table_megabytes << " MB" << std::endl;
+	else
+		log << "no table" << std::endl;
+	for (unsigned threads = 1u; threads <= max_threads;
+		threads = (threads * 2u > max_threads && threads < max_threads)
+			? max_threads : threads * 2u)
+	{
+		// Each run gets a fresh table so that none benefits from another.
+		std::unique_ptr<PerftTable> table;
+		if (table_megabytes != 0u)
+			table.reset (new PerftTable (table_megabytes));
+
+		ParallelPerft perft (root, threads, table.get ());
+		perft.count (depth);
+		if (threads == 1u)
+			base_seconds = perft.get_seconds ();
+
+		double speedup = (perft.get_seconds () > 0.0)
+			? base_seconds / perft.get_seconds () : 0.0;
+		log << "threads " << threads << ": " << perft.get_nodes ()
+			<< " nodes in " << std::fixed << std::setprecision (3)
+			<< perft.get_seconds () << " s (" << std::setprecision (0)
+			<< perft.get_nps () << " nps), speedup "
+			<< std::setprecision (2) << speedup << ", efficiency "
+			<< std::setprecision (0) << (100.0 * speedup / threads)
+			<< "%" << std::endl;
+	}
+}
+
+
+
+} // namespace Chess
@@ -0,0 +1,141 @@
+/******************************************************************************
+ *  ChessPerft.hh
+ *
+ *  Copyright (C) 2013 Kevin Daughtridge <kevin@kdau.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#ifndef CHESSPERFT_HH
+#define CHESSPERFT_HH
+
+#include "ChessGame.hh"
+#include <atomic>
+
+namespace Chess {
+
+
+
+// Perft: counts the leaf nodes of the legal move tree to verify and time
+// move generation
+
+class Perft
+{
+public:
+	explicit Perft (const Position& root);
+
+	// Counts the positions reached after exactly depth moves.
+	uint64_t count (unsigned depth);
+
+	// Counts the positions under each legal move from the root.
+	typedef std::pair<CompactMove, uint64_t> Branch;
+	typedef std::vector<Branch> Division;
+	Division divide (unsigned depth);
+
+	// Statistics of the last count or divide
+	uint64_t get_nodes () const { return nodes; }
+	double get_seconds () const { return seconds; }
+	double get_nps () const;
+
+	// Standard test positions with their published counts. These include
+	// underpromotions, so perft generates them although play does not.
+	static constexpr unsigned MAX_REFERENCE_DEPTH = 6u;
+	struct Reference
+	{
+		const char* name;
+		const char* fen;
+		uint64_t nodes [MAX_REFERENCE_DEPTH]; // by depth - 1; 0 if unknown
+	};
+	static const Reference REFERENCES [];
+	static const size_t N_REFERENCES;
+
+	// Counts each reference position to the given depth, writing a line
+	// per count to the log. Returns whether all counts matched.
+	static bool verify (unsigned max_depth, std::ostream& log);
+
+private:
+	Position root;
+	uint64_t nodes;
+	double seconds;
+};
+
+
+
+// PerftTable: lockless hash table of subtree counts, shareable by threads
+
+class PerftTable
+{
+public:
+	explicit PerftTable (size_t megabytes);
+	PerftTable (const PerftTable&) = delete;
+
+	bool probe (Position::Key, unsigned depth, uint64_t& nodes) const;
+	void store (Position::Key, unsigned depth, uint64_t nodes);
+
+private:
+	// The check word is the key XOR the data, so an entry torn by a
+	// concurrent store fails its probe instead of giving a wrong count.
+	struct Entry
+	{
+		std::atomic<uint64_t> check;
+		std::atomic<uint64_t> data; // nodes | depth << 56
+	};
+	std::unique_ptr<Entry[]> entries;
+	size_t mask;
+
+	Entry& get_entry (Position::Key, unsigned depth) const;
+};
+
+
+
+// ParallelPerft: perft split into tasks shared among worker threads
+
+class ParallelPerft
+{
+public:
+	// Zero threads means one per hardware thread. The table is optional.
+	explicit ParallelPerft (const Position& root, unsigned threads = 0u,
+		PerftTable* table = nullptr);
+
+	uint64_t count (unsigned depth);
+
+	unsigned get_threads () const { return threads; }
+	uint64_t get_nodes () const { return nodes; }
+	double get_seconds () const { return seconds; }
+	double get_nps () const;
+
+	// Counts the position with one thread and then with doubling numbers
+	// up to the hardware maximum, writing the speedup and efficiency of
+	// each. A table of the given size is used if it is nonzero.
+	static void report_scaling (const Position& root, unsigned depth,
+		std::ostream& log, size_t table_megabytes = 0u);
+
+	// Subtrees this shallow are counted within one task.
+	static constexpr unsigned SERIAL_DEPTH = 3u;
+
+private:
+	Position root;
+	unsigned threads;
+	PerftTable* table;
+	uint64_t nodes;
+	double seconds;
+};
+
+
+
+} // namespace Chess
+
+#endif // CHESSPERFT_HH
@@ -22,20 +22,81 @@
 
 
 
-// Callback for Chess module
+// Parameter and LGMulti support for Chess types
 
-namespace Chess {
+namespace Thief {
 
+LGMulti<Chess::Piece>::LGMulti (const Chess::Piece& value)
+	: LGMulti<int> (value.get_code ())
+{}
+
+LGMulti<Chess::Piece>::operator Chess::Piece () const
+{
+	return Chess::Piece (char (operator int ()));
+}
+
+LGMulti<Chess::Side>::LGMulti (const Chess::Side& value)
+	: LGMulti<int> (value.value)
+{}
+
+LGMulti<Chess::Side>::operator Chess::Side () const
+{
+	return Chess::Side (Chess::Side::Value (operator int ()));
+}
+
+THIEF_ENUM_CODING (Chess::Side::Value, CODE, CODE,
+	THIEF_ENUM_VALUE (NONE, "-", "none"),
+	THIEF_ENUM_VALUE (WHITE, "w", "white"),
+	THIEF_ENUM_VALUE (BLACK, "b", "black"),
+)
+
+template<>
+bool
+Parameter<Chess::Side>::decode (const String& raw) const
+{
+	if (raw.empty ())
+		return false;
+
+	value.value = Chess::Side::Value
+		(EnumCoding::get<Chess::Side::Value> ().decode (raw));
+	return true;
+}
+
+template<>
 String
-translate (const String& msgid, Side side)
+Parameter<Chess::Side>::encode () const
+{
+	return EnumCoding::get<Chess::Side::Value> ().encode (value.value);
+}
+
+} // namespace Thief
+
+
+
+// Hooks for Chess module
+
+static String
+translate_chess (const String& msgid, Side side)
 {
 	return Interface::get_text ("strings", "chess", side.is_valid ()
 		? (msgid + std::to_string (ChessSet (side).number))
 		: msgid);
+}
 
+static void
+log_chess (const String& message)
+{
+	Thief::mono.log (message);
 }
 
-} // namespace Chess
+static struct ChessHooks
+{
+	ChessHooks ()
+	{
+		Chess::set_translator (translate_chess);
+		Chess::set_logger (log_chess);
+	}
+} chess_hooks;
 
 
 
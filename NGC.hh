@@ -27,6 +27,16 @@ using namespace Thief;
 #include "Chess.hh"
 using namespace Chess;
 
+namespace Thief {
+
+THIEF_LGMULTI_SPECIALIZE_ (Chess::Piece, LGMulti<int>, Chess::Piece ())
+THIEF_LGMULTI_SPECIALIZE_ (Chess::Side, LGMulti<int>, Chess::Side ())
+
+template<> bool Parameter<Chess::Side>::decode (const String& raw) const;
+template<> String Parameter<Chess::Side>::encode () const;
+
+} // namespace Thief
+
 
 // Team: separation of Side (white vs. black) from player (good) vs. engine (bad)
 
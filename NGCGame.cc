@@ -44,6 +44,8 @@ GameMessage::GameMessage (Side side, float luminance_mult)
 NGCGame::NGCGame (const String& _name, const Object& _host)
 	: Script (_name, _host),
 	  THIEF_PERSISTENT (record),
+	  record_tail (0u),
+	  recorded_events (0u),
 	  THIEF_PERSISTENT_FULL (good_side, Side::NONE),
 	  THIEF_PERSISTENT_FULL (evil_side, Side::NONE),
 	  THIEF_PERSISTENT_FULL (state, State::NONE),
@@ -125,9 +127,13 @@ NGCGame::initialize ()
 
 	if (record.exists ()) // existing game
 	{
-		std::istringstream _record (record);
+		std::istringstream _record (read_record ());
 		try { game.reset (new Game (_record)); }
 		CATCH_SCRIPT_FAILURE ("initialize", return)
+		if (game->get_record_format () == Game::RecordFormat::TEXT)
+			recorded_events = game->get_history ().size ();
+		else
+			update_record (); // in the current format
 
 		if (game->get_result () != Game::Result::ONGOING)
 			return; // Don't start the engine at all.
@@ -314,14 +320,101 @@ NGCGame::create_piece (const Object& square, const Piece& _piece,
 	return piece;
 }
 
+const size_t
+NGCGame::RECORD_CHUNK = 512u;
+
+String
+NGCGame::read_record ()
+{
+	String text = record;
+	for (record_tail = 1u;; ++record_tail)
+	{
+		Persistent<String> chunk (*this,
+			get_record_chunk_name (record_tail));
+		if (!chunk.exists ()) break;
+		text += String (chunk);
+	}
+	--record_tail;
+	return text;
+}
+
+void
+NGCGame::write_record (const String& text)
+{
+	size_t index = 0u;
+	for (size_t at = 0u; at < text.size () || index == 0u;
+		at += RECORD_CHUNK, ++index)
+		set_record_chunk (index, text.substr (at, RECORD_CHUNK));
+	record_tail = index - 1u;
+
+	// Remove any chunks left from a longer record.
+	for (;; ++index)
+	{
+		Persistent<String> chunk (*this, get_record_chunk_name (index));
+		if (!chunk.exists ()) break;
+		chunk.remove ();
+	}
+}
+
+void
+NGCGame::append_record (const char* tokens, size_t length)
+{
+	String tail = get_record_chunk (record_tail);
+	if (tail.size () + length > RECORD_CHUNK)
+	{
+		++record_tail;
+		tail.clear ();
+	}
+	tail.append (tokens, length);
+	set_record_chunk (record_tail, tail);
+}
+
+String
+NGCGame::get_record_chunk (size_t index)
+{
+	if (index == 0u) return record;
+	return Persistent<String> (*this, get_record_chunk_name (index));
+}
+
+void
+NGCGame::set_record_chunk (size_t index, const String& text)
+{
+	if (index == 0u)
+		record = text;
+	else
+	{
+		Persistent<String> chunk (*this, get_record_chunk_name (index));
+		chunk = text;
+	}
+}
+
+String
+NGCGame::get_record_chunk_name (size_t index)
+{
+	return (index == 0u) ? String ("record")
+		: (boost::format ("record_%||") % index).str ();
+}
+
 void
 NGCGame::update_record ()
 {
 	if (game)
 	{
-		std::ostringstream _record;
-		game->serialize (_record);
-		record = _record.str ();
+		// Once the whole record has been written, only the new events
+		// need to be appended to its last chunk, without a stream.
+		size_t events = game->get_history ().size ();
+		char tokens [4u * (Event::MAX_MLAN_LENGTH + 1u) + 1u];
+		if (recorded_events == 0u || recorded_events > events ||
+		    events - recorded_events > 4u)
+		{
+			std::ostringstream _record;
+			game->serialize (_record);
+			write_record (_record.str ());
+		}
+		else if (recorded_events < events)
+			append_record (tokens, game->serialize_events
+				(tokens, sizeof tokens, recorded_events));
+		recorded_events = events;
 
 		// Update "moves made" statistic.
 		QuestVar ("stat_moves") = game->get_fullmove_number () - 1u;
@@ -347,9 +440,8 @@ NGCGame::update_sim ()
 	// Create new possible-move links.
 	for (auto& move : game->get_possible_moves ())
 	{
-		if (!move) continue;
-		Object from = get_square (move->get_from ()),
-			to = get_square (move->get_to ());
+		Object from = get_square (move.get_from ()),
+			to = get_square (move.get_to ());
 		if (from != Object::NONE && to != Object::NONE)
 			Link::create ("Route", from, to);
 	}
@@ -1159,9 +1251,9 @@ NGCGame::show_logbook (Message& message)
 			<< std::endl << std::endl;
 
 		unsigned halfmove = 0u, page = 0u;
-		for (auto& entry : game->get_history ())
+		for (auto& event : game->get_history ().get_events ())
 		{
-			if (!entry.second) continue;
+			if (!event) continue;
 			if (halfmove % 9u == 0u)
 			{
 				if (halfmove != 0u)
@@ -1170,7 +1262,7 @@ NGCGame::show_logbook (Message& message)
 				book << Game::get_logbook_heading (page)
 					<< std::endl << std::endl;
 			}
-			String description = entry.second->describe ();
+			String description = event->describe ();
 			book << Game::get_halfmove_prefix (halfmove)
 				<< description << std::endl << std::endl;
 			plain << Game::get_halfmove_prefix (halfmove)
@@ -55,13 +55,26 @@ private:
 	Object create_piece (const Object& square, const Piece&,
 		bool start_positioned, bool proxy = false);
 
+	// The record is kept in chunks of at most RECORD_CHUNK characters,
+	// "record" followed by "record_1", "record_2" and so on, so that a move
+	// only rewrites the last chunk.
+	static const size_t RECORD_CHUNK;
+	String read_record ();
+	void write_record (const String&);
+	void append_record (const char* tokens, size_t length);
+	String get_record_chunk (size_t index);
+	void set_record_chunk (size_t index, const String&);
+	static String get_record_chunk_name (size_t index);
+
 	void update_record ();
 	void update_sim ();
 	void update_interface ();
 	Message::Result tick_tock (TimerMessage&);
 
 	Chess::Game::Ptr game;
-	Persistent<String> record;
+	Persistent<String> record; // the first chunk
+	size_t record_tail; // index of the last chunk
+	size_t recorded_events; // in the record as last written, if any
 
 	Persistent<Side> good_side, evil_side;
 